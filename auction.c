@@ -199,6 +199,24 @@ int validate_elapsed_time(char *str) {
     return 1;
 }
 
+// Format: up to RECORD_OFFSET_MAX_LEN digits
+int validate_record_offset(char *str) {
+    if (!str || (*str == '\0')) return 0;
+
+    for (int i = 0; i <= RECORD_OFFSET_MAX_LEN; i++, str++) {
+        if (!isdigit(*str)) {
+            return (*str == '\0');
+        }
+    }
+
+    return 0;
+}
+
+// Format: bids per SRC page, between 1 and RECORD_BIDS_MAX
+int validate_record_limit(char *str) {
+    return validate_record_offset(str) && (atoi(str) >= 1) && (atoi(str) <= RECORD_BIDS_MAX);
+}
+
 /*
  *  Returns true if the given memory region follows the syntax rules of the auction protocol.
  *  A well-structured protocol message is composed by arguments, separated by exactly one space,
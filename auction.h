@@ -14,6 +14,14 @@
 #define TIME_LEN 8
 #define ELAPSED_TIME_LEN 5
 
+/* Room for "%03d" of any int, so that formatting an AID never overflows */
+#define AUCTION_ID_BUFSIZ 12
+
+/* Bids per SRC reply: the window sent when none is requested, and the largest one allowed */
+#define RECORD_BIDS_DEFAULT 50
+#define RECORD_BIDS_MAX 100
+#define RECORD_OFFSET_MAX_LEN 6
+
 int validate_user_id(char *str);
 
 int validate_user_password(char *str);
@@ -38,6 +46,10 @@ int validate_time(char *str);
 
 int validate_elapsed_time(char *str);
 
+int validate_record_offset(char *str);
+
+int validate_record_limit(char *str);
+
 int validate_protocol_message(char *str, int length);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, random()
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "bidbook.h"
+
+/*
+ * Bids of every auction, ordered by value and then by time, in a shared mapping created before
+ * the listeners are forked. Each auction is an indexable skiplist: inserting is O(log n), so
+ * bids accepted concurrently may arrive slightly out of order, the highest bid is the last node,
+ * and a window of bids is found by position in O(log n) and read without touching the storage.
+ * Rebuilt from the storage at startup, bids are only ever added afterwards.
+ */
+static bid_book_t *book = NULL;
+
+static void book_lock(book_auction_t *auction) {
+    while (__atomic_test_and_set(&auction->lock, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static void book_unlock(book_auction_t *auction) {
+    __atomic_clear(&auction->lock, __ATOMIC_RELEASE);
+}
+
+static int bid_less(bid_record_t *a, bid_record_t *b) {
+    return (a->value < b->value) || ((a->value == b->value) && (a->time < b->time));
+}
+
+static int random_level() {
+    int level = 1;
+    while ((level < BOOK_LEVELS) && (random() & 1)) {
+        level++;
+    }
+
+    return level;
+}
+
+int bidbook_init() {
+    book = mmap(NULL, sizeof(bid_book_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (book == MAP_FAILED) {
+        perror("mmap");
+        book = NULL;
+        return -1;
+    }
+
+    // every head points past the end of its empty list
+    for (int aid = 0; aid <= MAX_AUCTIONS; aid++) {
+        for (int i = 0; i < BOOK_LEVELS; i++) {
+            book->nodes[aid].next[i] = -1;
+            book->nodes[aid].width[i] = 1;
+        }
+        book->auctions[aid].last = -1;
+    }
+
+    book->n_nodes = MAX_AUCTIONS + 1;
+    return 0;
+}
+
+/* Returns SUCCESS, or ERROR if the book is full, in which case the auction is read from storage. */
+int bidbook_insert(int aid, bid_record_t *record) {
+    book_auction_t *auction = &book->auctions[aid];
+    int32_t update[BOOK_LEVELS];
+    int rank[BOOK_LEVELS];
+
+    int n = __atomic_fetch_add(&book->n_nodes, 1, __ATOMIC_ACQ_REL);
+    if (n >= MAX_AUCTIONS + 1 + BOOK_MAX_BIDS) {
+        __atomic_store_n(&auction->incomplete, 1, __ATOMIC_RELEASE);
+        return ERROR;
+    }
+
+    book_node_t *node = &book->nodes[n];
+    node->record = *record;
+
+    book_lock(auction);
+
+    // last node before the new one on every level, and its position
+    int32_t x = aid; // heads are the first nodes, one per AID
+    for (int i = BOOK_LEVELS - 1; i >= 0; i--) {
+        rank[i] = (i == BOOK_LEVELS - 1) ? 0 : rank[i+1];
+        while ((book->nodes[x].next[i] != -1) && bid_less(&book->nodes[book->nodes[x].next[i]].record, record)) {
+            rank[i] += book->nodes[x].width[i];
+            x = book->nodes[x].next[i];
+        }
+        update[i] = x;
+    }
+
+    int level = random_level();
+    for (int i = 0; i < BOOK_LEVELS; i++) {
+        book_node_t *prev = &book->nodes[update[i]];
+        if (i < level) {
+            node->next[i] = prev->next[i];
+            node->width[i] = prev->width[i] - (rank[0] - rank[i]);
+            prev->next[i] = n;
+            prev->width[i] = (rank[0] - rank[i]) + 1;
+        } else {
+            prev->width[i]++;
+        }
+    }
+
+    if (node->next[0] == -1) {
+        auction->last = n;
+    }
+    auction->count++;
+
+    book_unlock(auction);
+    return SUCCESS;
+}
+
+/* Returns SUCCESS with the highest bid, or NOT_FOUND if there is none. */
+int bidbook_max(int aid, bid_record_t *record) {
+    book_auction_t *auction = &book->auctions[aid];
+    int ret = NOT_FOUND;
+
+    book_lock(auction);
+    if (auction->last != -1) {
+        *record = book->nodes[auction->last].record;
+        ret = SUCCESS;
+    }
+    book_unlock(auction);
+
+    return ret;
+}
+
+/*
+ * Copies up to max bids, starting at the offset-th lowest one.
+ * Returns the number of bids copied, or ERROR if the book does not hold every bid of the auction.
+ */
+int bidbook_read(int aid, bid_record_t *records, int offset, int max) {
+    book_auction_t *auction = &book->auctions[aid];
+    int n_bids = 0;
+
+    if (__atomic_load_n(&auction->incomplete, __ATOMIC_ACQUIRE)) {
+        return ERROR;
+    }
+
+    book_lock(auction);
+
+    // descend to the node right before the window
+    int32_t x = aid; // heads are the first nodes, one per AID
+    int pos = 0;
+    for (int i = BOOK_LEVELS - 1; i >= 0; i--) {
+        while ((book->nodes[x].next[i] != -1) && (pos + book->nodes[x].width[i] <= offset)) {
+            pos += book->nodes[x].width[i];
+            x = book->nodes[x].next[i];
+        }
+    }
+
+    for (x = book->nodes[x].next[0]; (x != -1) && (n_bids < max); x = book->nodes[x].next[0]) {
+        records[n_bids++] = book->nodes[x].record;
+    }
+
+    book_unlock(auction);
+    return n_bids;
+}
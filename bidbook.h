@@ -0,0 +1,43 @@
+#ifndef _BIDBOOK_H_
+#define _BIDBOOK_H_
+
+#include <stdint.h>
+
+#include "database.h"
+#include "index.h"
+
+#define BOOK_LEVELS 16
+#define BOOK_MAX_BIDS 65536
+
+/*
+ * Node of an indexable skiplist. width[i] is how many positions next[i] advances, so that the
+ * n-th bid is found without walking the ones before it. Heads are nodes too, one per AID.
+ */
+typedef struct {
+	bid_record_t record;
+	int32_t next[BOOK_LEVELS];
+	int32_t width[BOOK_LEVELS];
+} book_node_t;
+
+typedef struct {
+	char lock;
+	char incomplete; // some bid did not fit, the storage must be read instead
+	int count;
+	int32_t last;
+} book_auction_t;
+
+typedef struct {
+	int n_nodes;
+	book_auction_t auctions[MAX_AUCTIONS+1];
+	book_node_t nodes[MAX_AUCTIONS+1+BOOK_MAX_BIDS];
+} bid_book_t;
+
+int bidbook_init();
+
+int bidbook_insert(int aid, bid_record_t *record);
+
+int bidbook_max(int aid, bid_record_t *record);
+
+int bidbook_read(int aid, bid_record_t *records, int offset, int max);
+
+#endif
@@ -0,0 +1,141 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bidlog.h"
+#include "database.h"
+#include "fsdir.h"
+#include "index.h"
+
+/*
+ * Append-only storage for bids. Every auction keeps its bids in AUCTIONS/<aid>/BIDS.log and
+ * every user keeps the auctions it bid on in USERS/<uid>/BIDDED.log, both as fixed-size binary
+ * records. Records are written with a single O_APPEND write, so concurrent listeners never
+ * interleave them, and read back with a single pread. Logs are opened relative to the cached
+ * directory of their auction or user, see fsdir.c.
+ */
+
+int append_record(int dirfd, char *name, void *record, size_t size) {
+    int fd = (dirfd == -1) ? -1 : openat(dirfd, name, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        perror("openat");
+        return ERROR;
+    }
+
+    ssize_t n = write(fd, record, size);
+    close(fd);
+
+    return (n == (ssize_t) size) ? SUCCESS : ERROR;
+}
+
+/* Returns the number of bytes read, 0 if the log does not exist yet, or ERROR. */
+ssize_t read_records(int dirfd, char *name, void *records, size_t size, off_t offset) {
+    int fd = (dirfd == -1) ? -1 : openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return (errno == ENOENT) ? 0 : ERROR;
+    }
+
+    ssize_t n = pread(fd, records, size, offset);
+    close(fd);
+
+    return n;
+}
+
+/* ---- Bids ---- */
+
+void bid_record_info(bid_record_t *record, bid_info_t *info) {
+    time_t bid_fulltime = record->time;
+    struct tm *timeinfo = localtime(&bid_fulltime);
+
+    strcpy(info->uid, record->uid);
+    sprintf(info->value, "%u", record->value);
+    strftime(info->date, sizeof(info->date), "%Y-%m-%d", timeinfo);
+    strftime(info->time, sizeof(info->time), "%H:%M:%S", timeinfo);
+    sprintf(info->sec_time, "%u", record->elapsed);
+}
+
+int bidlog_append_bid(int aid, bid_record_t *record) {
+    return append_record(fsdir_auction(aid), "BIDS.log", record, sizeof(bid_record_t));
+}
+
+/*
+ * Returns the number of records read, starting at the offset-th bid in the order they were
+ * accepted, or ERROR. Only the requested window is read.
+ */
+int bidlog_read_bids(int aid, bid_record_t *records, int offset, int max) {
+    ssize_t n = read_records(fsdir_auction(aid), "BIDS.log", records, max * sizeof(bid_record_t), (off_t) offset * sizeof(bid_record_t));
+    return (n < 0) ? ERROR : (int) (n / sizeof(bid_record_t));
+}
+
+/**
+ * Reads the highest bid of an auction. Bids are accepted in increasing order, but concurrent
+ * listeners may append them slightly out of order, so the whole log is scanned.
+ * Returns:
+ * - ERROR if a general error occurred.
+ * - NOT_FOUND if no bids have been placed.
+ * - SUCCESS otherwise.
+*/
+int bidlog_max_bid(int aid, bid_record_t *record) {
+    bid_record_t records[BUFSIZ / sizeof(bid_record_t)];
+    int fd, found = 0;
+    ssize_t n;
+
+    int auction_fd = fsdir_auction(aid);
+    if ((auction_fd == -1) || ((fd = openat(auction_fd, "BIDS.log", O_RDONLY | O_CLOEXEC)) == -1)) {
+        return (errno == ENOENT) ? NOT_FOUND : ERROR;
+    }
+
+    while ((n = read(fd, records, sizeof(records))) > 0) {
+        for (ssize_t i = 0; i < n / (ssize_t) sizeof(bid_record_t); i++) {
+            if (!found || (records[i].value > record->value)) {
+                *record = records[i];
+                found = 1;
+            }
+        }
+    }
+    close(fd);
+
+    if (n < 0) return ERROR;
+    return found ? SUCCESS : NOT_FOUND;
+}
+
+/* ---- Bidded ---- */
+
+int bidlog_append_bidded(char *uid, int aid) {
+    int32_t record = aid;
+    return append_record(fsdir_user(uid), "BIDDED.log", &record, sizeof(record));
+}
+
+/**
+ * Marks bidded[aid] for every auction the user has bid on. The array must hold MAX_AUCTIONS+1
+ * flags, all cleared.
+ * Returns:
+ * - ERROR if a general error occurred.
+ * - the number of distinct auctions otherwise.
+*/
+int bidlog_read_bidded(char *uid, char *bidded) {
+    int32_t records[BUFSIZ / sizeof(int32_t)];
+    int fd, count = 0;
+    ssize_t n;
+
+    int user_fd = fsdir_user(uid);
+    if ((user_fd == -1) || ((fd = openat(user_fd, "BIDDED.log", O_RDONLY | O_CLOEXEC)) == -1)) {
+        return (errno == ENOENT) ? 0 : ERROR;
+    }
+
+    while ((n = read(fd, records, sizeof(records))) > 0) {
+        for (ssize_t i = 0; i < n / (ssize_t) sizeof(int32_t); i++) {
+            int aid = records[i];
+            if ((aid >= 1) && (aid <= MAX_AUCTIONS) && !bidded[aid]) {
+                bidded[aid] = 1;
+                count++;
+            }
+        }
+    }
+    close(fd);
+
+    return (n < 0) ? ERROR : count;
+}
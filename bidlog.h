@@ -0,0 +1,18 @@
+#ifndef _BIDLOG_H_
+#define _BIDLOG_H_
+
+#include "database.h"
+
+void bid_record_info(bid_record_t *record, bid_info_t *info);
+
+int bidlog_append_bid(int aid, bid_record_t *record);
+
+int bidlog_read_bids(int aid, bid_record_t *records, int offset, int max);
+
+int bidlog_max_bid(int aid, bid_record_t *record);
+
+int bidlog_append_bidded(char *uid, int aid);
+
+int bidlog_read_bidded(char *uid, char *bidded);
+
+#endif
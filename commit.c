@@ -0,0 +1,143 @@
+#define _GNU_SOURCE // syscall()
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "commit.h"
+#include "database.h"
+
+/*
+ * Group commit. Listeners take a ticket after every mutation and hold the reply until a flush
+ * covers it. A dedicated process flushes the storage once per batch, either when
+ * batch_records mutations are pending or window_us after the first of them, so concurrent
+ * requests share a single flush instead of paying for one each.
+ * Blocking waiters sleep on the completed counter, the epoll listener is woken by an eventfd.
+ */
+static commit_state_t *commit = NULL;
+static long commit_window_us = 0;
+static int commit_records = COMMIT_DEFAULT_RECORDS;
+static int commit_eventfd = -1;
+
+int futex_wait(uint32_t *addr, uint32_t val, struct timespec *timeout) {
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+int futex_wake(uint32_t *addr, int count) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+int commit_init(long window_us, int batch_records) {
+    commit = mmap(NULL, sizeof(commit_state_t), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (commit == MAP_FAILED) {
+        perror("mmap");
+        commit = NULL;
+        return -1;
+    }
+
+    commit_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (commit_eventfd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+
+    commit_window_us = window_us;
+    commit_records = batch_records;
+    return 0;
+}
+
+int commit_enabled() {
+    return commit != NULL;
+}
+
+/* Returns the ticket covering the mutations made so far by the caller. */
+uint32_t commit_request() {
+    uint32_t ticket = __atomic_add_fetch(&commit->requested, 1, __ATOMIC_ACQ_REL);
+    uint32_t pending = ticket - __atomic_load_n(&commit->completed, __ATOMIC_ACQUIRE);
+
+    // the flusher sleeps until the first mutation and then until the batch is full
+    if ((pending == 1) || (pending == (uint32_t) commit_records)) {
+        futex_wake(&commit->requested, 1);
+    }
+
+    return ticket;
+}
+
+int commit_done(uint32_t ticket) {
+    return (int32_t) (__atomic_load_n(&commit->completed, __ATOMIC_ACQUIRE) - ticket) >= 0;
+}
+
+void commit_wait(uint32_t ticket) {
+    uint32_t completed;
+    while ((int32_t) ((completed = __atomic_load_n(&commit->completed, __ATOMIC_ACQUIRE)) - ticket) < 0) {
+        futex_wait(&commit->completed, completed, NULL);
+    }
+}
+
+int commit_fd() {
+    return commit_eventfd;
+}
+
+/* ---- Flusher ---- */
+
+void timespec_add_us(struct timespec *ts, long us) {
+    ts->tv_sec += us / 1000000;
+    ts->tv_nsec += (us % 1000000) * 1000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+void commit_run() {
+    struct timespec deadline, now, remaining;
+    uint64_t one = 1;
+
+    while (1) {
+        uint32_t requested = __atomic_load_n(&commit->requested, __ATOMIC_ACQUIRE);
+        uint32_t completed = __atomic_load_n(&commit->completed, __ATOMIC_ACQUIRE);
+
+        if (requested == completed) {
+            futex_wait(&commit->requested, requested, NULL);
+            continue;
+        }
+
+        // let the batch fill up, for at most one window
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        timespec_add_us(&deadline, commit_window_us);
+
+        while (requested - completed < (uint32_t) commit_records) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000;
+            }
+            if (remaining.tv_sec < 0) break;
+
+            futex_wait(&commit->requested, requested, &remaining);
+            requested = __atomic_load_n(&commit->requested, __ATOMIC_ACQUIRE);
+        }
+
+        // everything up to this ticket was written before the flush started
+        if (sync_storage() == ERROR) {
+            printf("ERROR\n");
+        }
+
+        __atomic_store_n(&commit->completed, requested, __ATOMIC_RELEASE);
+        futex_wake(&commit->completed, INT_MAX);
+
+        if (write(commit_eventfd, &one, sizeof(one)) == -1) {
+            perror("write");
+        }
+    }
+}
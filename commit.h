@@ -0,0 +1,28 @@
+#ifndef _COMMIT_H_
+#define _COMMIT_H_
+
+#include <stdint.h>
+
+#define COMMIT_DEFAULT_RECORDS 64
+
+/* Tickets handed out to mutations and the last one made durable, shared by every process. */
+typedef struct {
+	uint32_t requested;
+	uint32_t completed;
+} commit_state_t;
+
+int commit_init(long window_us, int batch_records);
+
+int commit_enabled();
+
+uint32_t commit_request();
+
+int commit_done(uint32_t ticket);
+
+void commit_wait(uint32_t ticket);
+
+int commit_fd();
+
+void commit_run();
+
+#endif
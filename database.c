@@ -6,18 +6,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
-#include <ctype.h>
-#include <sys/time.h>
 #include <time.h>
-#include <sys/sendfile.h>
-#include <stdarg.h>
-
-/* Files */
-#include <sys/mman.h>
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <dirent.h>
+#include <limits.h>
+#include <sys/random.h>
+
 #include "database.h"
+#include "storage.h"
+#include "index.h"
+#include "bidbook.h"
 
 /* Auction Protocol */
 #include "auction.h"
@@ -25,801 +21,654 @@
 /* Misc */
 #include "utils.h"
 
-// recursively erase a dir
-int erase_dir(char *dirname) {
-    DIR *d = opendir(dirname);
-    int r = -1;
-
-    if (d) {
-        struct dirent *p;
-
-        r = 0;
-        while (!r && (p = readdir(d))) {
-            int r2 = -1;
-            char buffer[BUFSIZ_L];
+/*
+ * Answers the protocol from the in-memory auction index and the storage backend chosen at
+ * startup, which persists users, auctions, bids and assets.
+ */
+storage_backend_t *storage = &dir_backend;
 
-            if (!strcmp(p->d_name, ".") || !strcmp(p->d_name, "..")) {
-                continue;
-            }
+storage_backend_t *backends[] = { &dir_backend, &memory_backend, &file_backend };
 
-            struct stat statbuf;
-
-            sprintf(buffer, "%s/%s", dirname, p->d_name);
-            if (!stat(buffer, &statbuf)) {
-                if (S_ISDIR(statbuf.st_mode)) {
-                    r2 = erase_dir(buffer);
-                } else {
-                    r2 = unlink(buffer);
-                }
-            }
-            r = r2;
+int set_storage_backend(char *name) {
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!strcmp(backends[i]->name, name)) {
+            storage = backends[i];
+            return SUCCESS;
         }
-        closedir(d);
     }
 
-    if (!r) {
-        r = rmdir(dirname);
-    }
+    return NOT_FOUND;
+}
 
-    return r;
+int init_storage() {
+    return storage->init();
 }
 
-int erase_login(char *uid) {
-    char login_name[60];
+char *storage_name() {
+    return storage->name;
+}
 
-    sprintf(login_name, "USERS/%s/%s_login.txt", uid, uid);
-    unlink(login_name);
-    return SUCCESS;
+char *storage_users_table() {
+    return storage->users_table;
 }
 
-int extract_password(char *uid, char *pwd) {
-    char pathname[BUFSIZ_S];
-    sprintf(pathname, "USERS/%s/%s_pass.txt", uid, uid);
-    FILE *file = fopen(pathname, "r");
-
-    if (file == NULL) {
-        if (errno != ENOENT) {
-            perror("fopen");
-            return ERROR;
-        }
+uint64_t storage_generation() {
+    return storage->generation();
+}
 
-        return ERR_USER_NOT_REGISTERED;
-    }
+// for backends whose records were just created, never 0
+uint64_t new_generation() {
+    uint64_t generation = 0;
 
-    if (fread(pwd, sizeof(char), USER_PWD_LEN, file) != USER_PWD_LEN) {
-        perror("fread");
-        return ERROR;
+    if (getrandom(&generation, sizeof(generation), 0) != sizeof(generation)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        generation = ((uint64_t) ts.tv_sec << 32) ^ ts.tv_nsec ^ getpid();
     }
-    
-    fclose(file);
 
-    pwd[USER_PWD_LEN] = '\0';
-    return SUCCESS;
+    return generation ? generation : 1;
 }
 
-int erase_password(char *uid) {
-    char pass_name[60];
-
-    sprintf(pass_name, "USERS/%s/%s_pass.txt", uid, uid);
-    unlink(pass_name);
-    return SUCCESS;
+// makes every mutation completed so far durable
+int sync_storage() {
+    return storage->sync();
 }
 
-int get_asset_file_info(char *aid, char *fname, off_t *fsize) {
-    char buffer[BUFSIZ_S];
-    sprintf(buffer, "AUCTIONS/%s/ASSET", aid);
+/* ---- Users ---- */
 
-    DIR *d = opendir(buffer);
-    struct dirent *p;
-    while ((p = readdir(d))) {
-        if (!validate_file_name(p->d_name)) {
-            continue;
+/*
+ * Users are answered from their session in the shared index. A session is loaded from the
+ * storage the first time its user is seen, and every change is written to the storage before
+ * the session, while holding its lock.
+ */
+// hosted auctions were already loaded into the index, which is rebuilt at every start
+void load_user_hosted(char *uid, user_entry_t *user) {
+    memset(&user->hosted, 0, sizeof(user->hosted));
+
+    int max_aid = index_next_aid() - 1;
+    for (int aid = 1; aid <= max_aid; aid++) {
+        int state = index_get_state(aid);
+        if (((state == ENTRY_OPEN) || (state == ENTRY_CLOSED)) && !strcmp(index_get(aid)->owner, uid)) {
+            auction_set_add(&user->hosted, aid);
         }
-        strcpy(fname, p->d_name);
-        break;
     }
-    closedir(d);
 
-    sprintf(buffer, "AUCTIONS/%s/ASSET/%s", aid, fname);
-    int fd = open(buffer, O_RDONLY);
-    if (fd == -1) {
+    user->boot = index_boot();
+    index_touch_user(user);
+}
+
+int load_user_auctions(char *uid, user_entry_t *user) {
+    char bidded[MAX_AUCTIONS+1] = { 0 };
+
+    load_user_hosted(uid, user);
+    memset(&user->bidded, 0, sizeof(user->bidded));
+
+    if (storage->read_bidded(uid, bidded) == ERROR) {
         return ERROR;
     }
 
-    struct stat statbuf;
-    if (fstat(fd, &statbuf) == -1) {
-        close(fd);
-        return ERROR;
+    for (int aid = 1; aid <= MAX_AUCTIONS; aid++) {
+        if (bidded[aid]) auction_set_add(&user->bidded, aid);
     }
 
-    *fsize = statbuf.st_size;
-    close(fd);
+    index_touch_user(user);
     return SUCCESS;
 }
 
-int add_user_auction(int next_aid, char *uid) {
-    char user_auction_name[60];
-    FILE *fp;
-    
-    sprintf(user_auction_name, "USERS/%s/HOSTED/%03d.txt", uid, next_aid);
-    if ((fp = fopen(user_auction_name, "w")) == NULL) {
-        return ERROR;
+user_entry_t *lock_user(char *uid) {
+    user_entry_t *user = index_lock_user(uid);
+    if (user == NULL) {
+        return NULL;
     }
-    fclose(fp);
-    return SUCCESS;
-}
 
-int create_end_file(char *aid, time_t end_fulltime) {
-    char end_filename[60];
-    char start_filename[60];
-    char end_datetime[DATE_LEN + TIME_LEN + 2];
-    long start_fulltime;
-    FILE *fp;
-
-    // read start info
-    sprintf(start_filename, "AUCTIONS/%s/START_%s.txt", aid, aid);
-    if ((fp = fopen(start_filename, "r")) == NULL) {
-        return ERROR;
+    // a session kept from a previous start may hold the hosted set of a reused AID
+    if ((user->state != SESSION_UNKNOWN) && (user->boot != index_boot())) {
+        load_user_hosted(uid, user);
     }
-    fscanf(fp, "%*s %*s %*s %*s %*s %*s %*s %ld", &start_fulltime);
-    fclose(fp);
 
-    struct tm *timeinfo;
-    timeinfo = localtime(&end_fulltime);
+    if (user->state != SESSION_UNKNOWN) {
+        return user;
+    }
 
-    sprintf(end_datetime, "%04d-%02d-%02d %02d:%02d:%02d",
-        timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
-        timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+    // on error the session stays unknown and is loaded again next time
+    if (load_user_auctions(uid, user) == ERROR) {
+        return user;
+    }
 
-    sprintf(end_filename, "AUCTIONS/%s/END_%s.txt", aid, aid);
-    if ((fp = fopen(end_filename, "w")) == NULL) {
-        return ERROR;
+    switch (storage->is_registered(uid)) {
+        case SUCCESS:
+            if (storage->get_password(uid, user->pwd) != SUCCESS) break;
+            user->logged_in = (storage->is_logged_in(uid) == SUCCESS);
+            user->state = SESSION_REGISTERED;
+            break;
+        case NOT_FOUND:
+            user->state = SESSION_UNREGISTERED;
+            break;
     }
-    // write end info
-    fprintf(fp, "%s %ld", end_datetime, end_fulltime - start_fulltime);
-    fclose(fp);
-    return SUCCESS;
+
+    return user;
 }
 
-int find_auction(char *aid) {
-    DIR *d = opendir("AUCTIONS");
-    struct dirent *p;
+/* Returns SUCCESS if the user is registered, NOT_FOUND if not, or ERROR. */
+int find_user_dir(char *uid) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
 
-    while ((p = readdir(d))) {
-        if (!strncmp(p->d_name, aid, 3)) {
-            closedir(d);
-            return SUCCESS;
-        }
+    int ret = ERROR;
+    if (user->state != SESSION_UNKNOWN) {
+        ret = (user->state == SESSION_REGISTERED) ? SUCCESS : NOT_FOUND;
     }
 
-    closedir(d);
-    return NOT_FOUND;
+    index_unlock_user(user);
+    return ret;
 }
 
-int find_end(char *aid) {
-    char end_name[60];
-    FILE *fp;
+int exists_user_login_file(char *uid) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
 
-    sprintf(end_name, "AUCTIONS/%s/END_%s.txt", aid, aid);
-    if ((fp = fopen(end_name, "r")) == NULL) {
-        if (errno == ENOENT) {
-            return NOT_FOUND;
-        } else {
-            return ERROR;
-        }
+    int ret = ERROR;
+    if (user->state != SESSION_UNKNOWN) {
+        ret = user->logged_in ? SUCCESS : NOT_FOUND;
     }
-    fclose(fp);
-    return SUCCESS;
+
+    index_unlock_user(user);
+    return ret;
 }
 
-int check_auction_state(char *aid) {
-    // if end file is found, then auction has ended
-    if (find_end(aid) == SUCCESS) {
-        return CLOSED;
+int erase_login(char *uid) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
+
+    int ret = storage->erase_login(uid);
+    if (ret != ERROR) {
+        user->logged_in = 0;
     }
 
-    char start_filename[60];
-    long start_fulltime, timeactive;
-    FILE *fp;
+    index_unlock_user(user);
+    return ret;
+}
 
-    sprintf(start_filename, "AUCTIONS/%s/START_%s.txt", aid, aid);
-    if ((fp = fopen(start_filename, "r")) == NULL) {
-        return ERROR;
+int extract_password(char *uid, char *pwd) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
+
+    int ret = ERROR;
+    if (user->state == SESSION_REGISTERED) {
+        strcpy(pwd, user->pwd);
+        ret = SUCCESS;
+    } else if (user->state == SESSION_UNREGISTERED) {
+        ret = ERR_USER_NOT_REGISTERED;
     }
-    fscanf(fp, "%*s %*s %*s %*s %ld %*s %*s %ld", &timeactive, &start_fulltime);
-    fclose(fp);
 
-    time_t curr_fulltime;
-    time(&curr_fulltime);
+    index_unlock_user(user);
+    return ret;
+}
 
-    // if end file is not found, calculate time elapsed since start
-    // to determine if it already ended or not
-    if ((curr_fulltime - start_fulltime) > timeactive) {
-        create_end_file(aid, start_fulltime + timeactive);
-        return CLOSED;
-    } else {
-        return OPEN;
+int erase_password(char *uid) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
+
+    int ret = storage->unregister_user(uid);
+    if (ret != ERROR) {
+        user->state = SESSION_UNREGISTERED;
+        user->logged_in = 0;
     }
+
+    index_unlock_user(user);
+    return ret;
 }
 
-// get the minimum value for new bids
-long get_max_bid_value(char *aid) {
-    struct dirent **filelist;
-    int n_entries, len;
-    int has_bids = 0;
-    long start_value, max_bid;
-
-    char dirname[60];
-    sprintf(dirname, "AUCTIONS/%s/BIDS", aid);
-    n_entries = scandir(dirname, &filelist, 0, alphasort);
-    if (n_entries <= 0)
-        return 0;
-    
-    // file names are order ascendently,
-    // so start from end to get max bid value
-    while (n_entries--) {
-        len = strlen(filelist[n_entries]->d_name);
-        if (len == AUCTION_VALUE_MAX_LEN+4) { // VVVVVV.txt - length 10
-            max_bid = atol(filelist[n_entries]->d_name);
-            has_bids = 1;
+/**
+ * Returns:
+ * - ERROR if an error occurred.
+ * - ERR_USER_ALREADY_LOGGED_IN if user is already logged in.
+ * - ERR_WRONG_PASSWORD if user exists but password does not match.
+ * - USER_LOGGED_IN if user was successfully logged in.
+ * - USER_REGISTERED if user was successfully registered.
+*/
+int login(char *uid, char *pwd) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
+
+    int ret = ERROR;
+    switch (user->state) {
+        case SESSION_UNREGISTERED:
+            if (storage->register_user(uid, pwd) == ERROR) break;
+            strcpy(user->pwd, pwd);
+            user->state = SESSION_REGISTERED;
+
+            if (storage->set_login(uid) == ERROR) break;
+            user->logged_in = 1;
+
+            ret = USER_REGISTERED;
             break;
-        }
-        free(filelist[n_entries]);
-    }
-    free(filelist);
+        case SESSION_REGISTERED:
+            if (user->logged_in) {
+                ret = ERR_USER_ALREADY_LOGGED_IN;
+                break;
+            }
 
-    // if no bids have been placed,
-    // then bids have to be bigger than start value
-    if (has_bids) {
-        return max_bid;
-    } else {
-        char start_filename[60];
-        FILE *fp;
-        sprintf(start_filename, "AUCTIONS/%s/START_%s.txt", aid, aid);
-        if ((fp = fopen(start_filename, "r")) == NULL) {
-            return ERROR;
-        }
-        fscanf(fp, "%*s %*s %*s %ld %*s %*s %*s %*s", &start_value);
-        fclose(fp);
-        return start_value;
-    }
-}
-
-// get the max auction ID existent to determine the ID of the next auction
-int get_next_aid() {
-    struct dirent **filelist;
-    int n_entries, len;
-    int max_auction_id = 0;
-
-    n_entries = scandir("AUCTIONS/", &filelist, 0, alphasort);
-    if (n_entries <= 0)
-        return 0;
-    
-    while (n_entries--) {
-        len = strlen(filelist[n_entries]->d_name);
-        if (len == AUCTION_ID_LEN) {
-            max_auction_id = atol(filelist[n_entries]->d_name);
+            if (strcmp(user->pwd, pwd)) {
+                ret = ERR_WRONG_PASSWORD;
+                break;
+            }
+
+            if (storage->set_login(uid) == ERROR) break;
+            user->logged_in = 1;
+
+            ret = USER_LOGGED_IN;
             break;
-        }
-        free(filelist[n_entries]);
     }
-    free(filelist);
 
-    return max_auction_id + 1;
+    index_unlock_user(user);
+    return ret;
 }
 
-int add_bid(char *uid, char *aid, long value) {
-    char bid_filename[60];
-    char start_filename[60];
-    long start_fulltime;
-    char bid_datetime[DATE_LEN + TIME_LEN + 2];
-    FILE *fp;
-
-    // read start full time to determine seconds elapsed since the start
-    sprintf(start_filename, "AUCTIONS/%s/START_%s.txt", aid, aid);
-    if ((fp = fopen(start_filename, "r")) == NULL) {
-        return ERROR;
+/**
+ * Returns:
+ * - ERROR if an error occurred.
+ * - ERR_USER_NOT_LOGGED_IN if user is not logged in.
+ * - ERR_WRONG_PASSWORD if user is logged in but password does not match.
+ * - SUCCESS if user is logged in with the given password.
+*/
+int authenticate_user(char *uid, char *pwd) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
+
+    int ret = SUCCESS;
+    if (user->state == SESSION_UNKNOWN) {
+        ret = ERROR;
+    } else if (!user->logged_in) {
+        ret = ERR_USER_NOT_LOGGED_IN;
+    } else if (strcmp(pwd, user->pwd)) {
+        ret = ERR_WRONG_PASSWORD;
     }
-    fscanf(fp, "%*s %*s %*s %*s %*s %*s %*s %ld", &start_fulltime);
-    fclose(fp);
 
-    time_t bid_fulltime;
-    time(&bid_fulltime);
-    struct tm *timeinfo;
-    timeinfo = localtime(&bid_fulltime);
+    index_unlock_user(user);
+    return ret;
+}
 
-    sprintf(bid_datetime, "%04d-%02d-%02d %02d:%02d:%02d",
-        timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
-        timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+/* ---- Auctions ---- */
 
-    sprintf(bid_filename, "AUCTIONS/%s/BIDS/%06ld.txt", aid, value);
-    if ((fp = fopen(bid_filename, "w")) == NULL) {
+int create_end_file(char *aid, time_t end_fulltime) {
+    auction_entry_t *entry = index_get(atoi(aid));
+    if (entry == NULL) {
         return ERROR;
     }
 
-    fprintf(fp, "%s %ld %s %ld", uid, value, bid_datetime, bid_fulltime - start_fulltime);
-    fclose(fp);
-    return SUCCESS;
-}
-
-int add_bidded(char *uid, char *aid) {
-    char bidded_filename[60];
-    FILE *fp;
-
-    sprintf(bidded_filename, "USERS/%s/BIDDED/%s.txt", uid, aid);
-    if ((fp = fopen(bidded_filename, "w")) == NULL) {
+    if (storage->write_end(atoi(aid), end_fulltime, end_fulltime - entry->start) == ERROR) {
         return ERROR;
     }
-    fclose(fp);
+
+    index_close(atoi(aid));
     return SUCCESS;
 }
 
-int find_user_auction(char *uid, char *aid) {
-    char dirname[60];
-    sprintf(dirname, "USERS/%s/HOSTED", uid);
+int find_auction(char *aid) {
+    // reserved auctions still receiving their asset are not visible yet
+    int state = index_get_state(atoi(aid));
+    return ((state == ENTRY_OPEN) || (state == ENTRY_CLOSED)) ? SUCCESS : NOT_FOUND;
+}
 
-    DIR *d = opendir(dirname);
-    struct dirent *p;
+int check_auction_state(char *aid) {
+    int state = index_get_state(atoi(aid));
 
-    while ((p = readdir(d))) {
-        if (!strncmp(p->d_name, aid, 3)) {
-            closedir(d);
-            return SUCCESS;
-        }
+    if (state == ENTRY_CLOSED) {
+        return CLOSED;
     }
 
-    closedir(d);
-    return NOT_FOUND;
-}
-
-// extract auctions from given user
-int extract_user_auctions(char *uid, char* auctions) {
-    char dirname[60];
-    sprintf(dirname, "USERS/%s/HOSTED/", uid);
-    
-    struct dirent **filelist;
-    int n_entries, len;
-    char aid[AUCTION_ID_LEN+1];
-    int count = 0, state, iter = 0;
-    ssize_t total_printed = 0, printed = 0;
-
-    n_entries = scandir(dirname, &filelist, 0, alphasort);
-    if (n_entries <= 0)
+    if (state != ENTRY_OPEN) {
         return ERROR;
-    
-    while (iter < n_entries) {
-        char entry_name[256];
-        memcpy(entry_name, filelist[iter]->d_name, 256);
-        len = strlen(entry_name);
-        if (len == AUCTION_ID_LEN + 4) { // AID.txt
-            memcpy(aid, entry_name, AUCTION_ID_LEN);
-            aid[AUCTION_ID_LEN] = '\0';
-            state = (check_auction_state(aid) == CLOSED) ? 0 : 1;
-            printed = sprintf(auctions+total_printed, " %s %d", aid, state);
-            if (printed < 0) {
-                return ERROR;
-            } else {
-                total_printed += printed;
-            }
-            count++;
-        }
-        free(filelist[iter]);
-        iter++;
     }
-    free(filelist);
 
-    return count;
+    auction_entry_t *entry = index_get(atoi(aid));
+
+    time_t curr_fulltime;
+    time(&curr_fulltime);
+
+    // the scheduler writes the END file, this only covers the moment until it does
+    if ((curr_fulltime - entry->start) >= entry->timeactive) {
+        return CLOSED;
+    } else {
+        return OPEN;
+    }
 }
 
-// extract auctions on which given user has placed bids
-int extract_user_bidded_auctions(char *uid, char* bidded) {
-    char dirname[60];
-    sprintf(dirname, "USERS/%s/BIDDED/", uid);
-    
-    struct dirent **filelist;
-    int n_entries, len;
-    char aid[AUCTION_ID_LEN+1];
-    int count = 0, state, iter = 0;
-    ssize_t total_printed = 0, printed = 0;
-
-    n_entries = scandir(dirname, &filelist, 0, alphasort);
-    if (n_entries <= 0)
+// get the minimum value for new bids
+long get_max_bid_value(char *aid) {
+    auction_entry_t *entry = index_get(atoi(aid));
+    if (entry == NULL) {
         return ERROR;
-    
-    while (iter < n_entries) {
-        char entry_name[256];
-        memcpy(entry_name, filelist[iter]->d_name, 256);
-        len = strlen(entry_name);
-        if (len == AUCTION_ID_LEN + 4) { // AID.txt
-            memcpy(aid, entry_name, AUCTION_ID_LEN);
-            aid[AUCTION_ID_LEN] = '\0';
-            state = (check_auction_state(aid) == CLOSED) ? 0 : 1;
-            printed = sprintf(bidded+total_printed, " %s %d", aid, state);
-            if (printed < 0) {
-                return ERROR;
-            } else {
-                total_printed += printed;
-            }
-            count++;
-        }
-        free(filelist[iter]);
-        iter++;
     }
-    free(filelist);
 
-    return count;
+    // start value while no bids have been placed
+    return __atomic_load_n(&entry->max_bid, __ATOMIC_ACQUIRE);
 }
 
-// extract all existent auctions
-int extract_auctions(char* auctions) {
-    struct dirent **filelist;
-    int n_entries, len, count = 0, state, iter = 0;
-    char aid[AUCTION_ID_LEN+1];
-    ssize_t total_printed = 0, printed = 0;
-
-    n_entries = scandir("AUCTIONS", &filelist, 0, alphasort);
-    if (n_entries <= 0)
-        return ERROR;
-    
-    while (iter < n_entries) {
-        len = strlen(filelist[iter]->d_name);
-        if (len == AUCTION_ID_LEN) {
-            memcpy(aid, filelist[iter]->d_name, AUCTION_ID_LEN);
-            aid[AUCTION_ID_LEN] = '\0';
-            state = (check_auction_state(aid) == CLOSED) ? 0 : 1;
-            printed = sprintf(auctions+total_printed, " %s %d", aid, state);
-            if (printed < 0) {
-                return ERROR;
-            } else {
-                total_printed += printed;
-            }
-            count++;
+// checked against the owner in the index, which is rebuilt from the storage at every start
+int find_user_auction(char *uid, char *aid) {
+    int state = index_get_state(atoi(aid));
+    if ((state != ENTRY_OPEN) && (state != ENTRY_CLOSED)) {
+        return NOT_FOUND;
+    }
+
+    return strcmp(index_get(atoi(aid))->owner, uid) ? NOT_FOUND : SUCCESS;
+}
+
+/*
+ * Prints " AID state" for every auction in the set, in ascending order. Auctions not in the
+ * open set are closed, the others are checked against their deadline in case they just expired.
+ * The listing stays accurate until *expires, the earliest deadline among the open ones.
+ * Returns the number of auctions printed.
+ */
+int print_auction_set(auction_set_t *set, char *buffer, time_t *expires) {
+    auction_set_t open;
+    char aid[AUCTION_ID_BUFSIZ];
+    int count = 0;
+
+    *expires = LONG_MAX;
+    index_open_set(&open);
+    for (int i = auction_set_next(set, 0); i != 0; i = auction_set_next(set, i)) {
+        sprintf(aid, "%03d", i);
+        int state = auction_set_has(&open, i) && (check_auction_state(aid) == OPEN);
+        buffer += sprintf(buffer, " %s %d", aid, state);
+        count++;
+
+        auction_entry_t *entry = index_get(i);
+        if (state && (entry->start + entry->timeactive < *expires)) {
+            *expires = entry->start + entry->timeactive;
         }
-        free(filelist[iter]);
-        iter++;
     }
-    free(filelist);
 
     return count;
 }
 
-int extract_auction_start_info(char *aid, start_info_t *start_info) {
-    char start_filename[60];
-    FILE *fp;
+/* Copies the hosted or bidded set of a user, returns ERROR if the session cannot be loaded. */
+int copy_user_set(char *uid, auction_set_t *set, int hosted) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
 
-    sprintf(start_filename, "AUCTIONS/%s/START_%s.txt", aid, aid);
-    if (!(fp = fopen(start_filename, "r"))) {
-        return ERROR;
+    int ret = ERROR;
+    if (user->state != SESSION_UNKNOWN) {
+        *set = hosted ? user->hosted : user->bidded;
+        ret = SUCCESS;
     }
-    fscanf(fp, "%s %s %s %s %s %s %s", start_info->uid, start_info->name, start_info->fname, 
-        start_info->value, start_info->timeactive, start_info->date, start_info->time);
-    fclose(fp);
-    return SUCCESS;
-}
-
-// extract information about all bids placed in a given auction
-int extract_auctions_bids_info(char *aid, bid_info_t *bids) {
-    char dirname[60];
-    sprintf(dirname, "AUCTIONS/%s/BIDS/", aid);
 
-    struct dirent **filelist;
-    int n_bids = 0, len, iter = 0;
-    FILE *fp;
+    index_unlock_user(user);
+    return ret;
+}
 
-    int n_entries = scandir(dirname, &filelist, 0, alphasort);
-    if (n_entries <= 0) {
-        return ERROR;
-    }
+/*
+ * Version of everything a listing of the user's auctions depends on besides the deadlines.
+ * Read it before extracting the listing, so that a change made meanwhile is not missed.
+*/
+int user_listing_version(char *uid, uint32_t *version) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
 
-    char *fds = bids[0].time;
-    fds++;
-    
-    char pathname[BUFSIZ_S+60];
-    while (iter < n_entries) {
-        len = strlen(filelist[iter]->d_name);
-        if (len == AUCTION_VALUE_MAX_LEN + 4) { // VVVVVV.txt
-            sprintf(pathname, "%s%s", dirname, filelist[iter]->d_name);
-            if (!(fp = fopen(pathname, "r"))) {
-                return ERROR;
-            }
-            fscanf(fp, "%s %s %s %s %s", bids[n_bids].uid, bids[n_bids].value,
-                bids[n_bids].date, bids[n_bids].time, bids[n_bids].sec_time);
-            n_bids++;
-            fclose(fp);
-        }
-        free(filelist[iter]);
-        if (n_bids == 50)
-            break;
-        iter++;
+    int ret = ERROR;
+    if (user->state != SESSION_UNKNOWN) {
+        *version = user->version;
+        ret = SUCCESS;
     }
-    free(filelist);
 
-    return n_bids;
+    index_unlock_user(user);
+    return ret;
 }
 
-int extract_auction_end_info(char *aid, end_info_t *end_info) {
-    char end_filename[60];
-    FILE *fp;
+uint32_t listing_version() {
+    return index_version();
+}
 
-    sprintf(end_filename, "AUCTIONS/%s/END_%s.txt", aid, aid);
-    if (!(fp = fopen(end_filename, "r"))) {
+// extract auctions from given user
+int extract_user_auctions(char *uid, char* auctions, time_t *expires) {
+    auction_set_t hosted;
+    if (copy_user_set(uid, &hosted, 1) == ERROR) {
         return ERROR;
     }
-    fscanf(fp, "%s %s %s", end_info->date, end_info->time, end_info->sec_time);
-    fclose(fp);
-    return SUCCESS;
-}
 
-/* ---- Utils ---- */
-
-int file_exists(char *pathname) {
-    FILE *file = fopen(pathname, "r");
-    
-    if (file != NULL) {
-        fclose(file);
-        return SUCCESS;
-    }
+    return print_auction_set(&hosted, auctions, expires);
+}
 
-    if (errno != ENOENT) {
-        perror("fopen");
+// extract auctions on which given user has placed bids
+int extract_user_bidded_auctions(char *uid, char* bidded, time_t *expires) {
+    auction_set_t set;
+    if (copy_user_set(uid, &set, 0) == ERROR) {
         return ERROR;
     }
 
-    return NOT_FOUND;
+    return print_auction_set(&set, bidded, expires);
 }
 
-/* ---- Users ---- */
+// extract all existent auctions
+int extract_auctions(char* auctions, time_t *expires) {
+    auction_set_t existing;
+    index_existing(&existing);
 
-int exists_user_password_file(char *uid) {
-    char pathname[BUFSIZ];
-    sprintf(pathname, "USERS/%s/%s_pass.txt", uid, uid);
-    return file_exists(pathname);
+    return print_auction_set(&existing, auctions, expires);
 }
 
-int exists_user_login_file(char *uid) {
-    char pathname[BUFSIZ_S];
-    sprintf(pathname, "USERS/%s/%s_login.txt", uid, uid);
-    return file_exists(pathname);
+int extract_auction_start_info(char *aid, start_info_t *start_info) {
+    return storage->read_start(atoi(aid), start_info);
 }
 
-int create_user_dirs(char *uid) {
-    char buffer[BUFSIZ_S];
-
-    sprintf(buffer, "USERS/%s", uid);
-    if ((mkdir(buffer, S_IRWXU) == -1) && (errno != EEXIST)) {
-        perror("mkdir");
-        return ERROR;
-    }
-
-    sprintf(buffer, "USERS/%s/HOSTED", uid);
-    if ((mkdir(buffer, S_IRWXU) == -1) && (errno != EEXIST)) {
-        perror("mkdir");
-        return ERROR;
+int extract_auction_end_info(char *aid, end_info_t *end_info) {
+    int ret = storage->read_end(atoi(aid), end_info);
+    if (ret != NOT_FOUND) {
+        return ret;
     }
 
-    sprintf(buffer, "USERS/%s/BIDDED", uid);
-    if ((mkdir(buffer, S_IRWXU) == -1) && (errno != EEXIST)) {
-        perror("mkdir");
+    if (check_auction_state(aid) != CLOSED) {
         return ERROR;
     }
 
+    // expired, but the scheduler has not written the END record yet
+    auction_entry_t *entry = index_get(atoi(aid));
+    time_t end_fulltime = entry->start + entry->timeactive;
+    struct tm *timeinfo = localtime(&end_fulltime);
+    strftime(end_info->date, sizeof(end_info->date), "%Y-%m-%d", timeinfo);
+    strftime(end_info->time, sizeof(end_info->time), "%H:%M:%S", timeinfo);
+    sprintf(end_info->sec_time, "%ld", entry->timeactive);
     return SUCCESS;
 }
 
-int create_user_login_file(char *uid) {
-    char pathname[60];
-    sprintf(pathname, "USERS/%s/%s_login.txt", uid, uid);
-
-    FILE *file = fopen(pathname, "w");
-    if (file == NULL) {
-        perror("fopen");
-        return ERROR;
-    }
-    
-    fclose(file);
-    return SUCCESS;
-}
-
-int create_user_password_file(char *uid, char *pwd) {
-    char pathname[BUFSIZ_S];
-    sprintf(pathname, "USERS/%s/%s_pass.txt", uid, uid);
-
-    FILE *file = fopen(pathname, "w");
-    if (file == NULL) {
-        perror("fopen");
-        return ERROR;
+/**
+ * Reserves the next auction ID, so that the asset can be received before the auction exists.
+ * The auction only becomes visible once create_auction() writes its START record.
+ * Returns:
+ * - ERROR if a general error occurred.
+ * - ERR_REACHED_AUCTION_MAX if the number of auctions reached its maximum.
+ * - the reserved auction ID otherwise.
+*/
+int reserve_auction() {
+    int aid;
+
+    while ((aid = index_reserve_next()) != -1) {
+        switch (storage->reserve_auction(aid)) {
+            case SUCCESS:
+                return aid;
+            case ERR_AUCTION_EXISTS:
+                // left in the storage by something other than this server, keep it reserved
+                continue;
+            default:
+                index_cancel(aid);
+                return ERROR;
+        }
     }
 
-    if (fwrite(pwd, sizeof(char), USER_PWD_LEN, file) < USER_PWD_LEN) {
-        perror("fwrite");
-        return ERROR;
-    }
-    
-    fclose(file);
-    return SUCCESS;
+    return ERR_REACHED_AUCTION_MAX;
 }
 
-int erase_user_dir(char *uid) {
-    char uid_dirname[60];
-
-    sprintf(uid_dirname, "USERS/%s", uid);
-    erase_dir(uid_dirname);
-
+int cancel_auction(int aid) {
+    storage->cancel_auction(aid);
+    index_cancel(aid);
     return SUCCESS;
 }
 
-int find_user_dir(char *uid) {
-    char uid_dirname[60];
-    FILE *fp;
-
-    sprintf(uid_dirname, "USERS/%s", uid);
-    if ((fp = fopen(uid_dirname, "r")) == NULL) {
-        if (errno == ENOENT) {
-            return NOT_FOUND;
-        } else {
-            return ERROR;
-        }
-    }
+/* Returns a descriptor to write the asset of a reserved auction, or -1 on error. */
+int create_asset_file(int aid, char *fname) {
+    return storage->create_asset(aid, fname);
+}
 
-    fclose(fp);
-    return SUCCESS;
+/* Returns a descriptor to read the asset of an auction, or -1 on error. */
+int open_asset_file(char *aid, char *fname, off_t *fsize) {
+    return storage->open_asset(atoi(aid), fname, fsize);
 }
 
 /**
+ * Completes a reserved auction whose asset was already received. The reservation is cancelled
+ * if the auction cannot be created.
  * Returns:
- * - ERROR if an error occurred.
- * - ERR_USER_ALREADY_LOGGED_IN if user is already logged in.
- * - ERR_WRONG_PASSWORD if user exists but password does not match.
- * - USER_LOGGED_IN if user was successfully logged in.
- * - USER_REGISTERED if user was successfully registered.
+ * - ERROR if a general error occurred.
+ * - the auction ID if auction was successfully created.
 */
-int login(char *uid, char *pwd) {
-    int status = exists_user_login_file(uid);
-
-    if (status == ERROR) return ERROR;
-    if (status == SUCCESS) return ERR_USER_ALREADY_LOGGED_IN;
-
-    char buffer[BUFSIZ_S];
-    switch (exists_user_password_file(uid)) {
-        case ERROR:
-            return ERROR;
-        case NOT_FOUND:
-            if (create_user_dirs(uid) == ERROR) return ERROR;
-            if (create_user_login_file(uid) == ERROR) return ERROR;
-            if (create_user_password_file(uid, pwd) == ERROR) return ERROR;
-
-            return USER_REGISTERED;
-        case SUCCESS:
-            extract_password(uid, buffer);
-
-            if (strcmp(buffer, pwd)) return ERR_WRONG_PASSWORD;
-            if (create_user_login_file(uid) == ERROR) return ERROR;
-
-            return USER_LOGGED_IN;
-        default:
-            return ERROR;
-    }
-}
-
-/* ---- Auctions ---- */
-
-int create_auction_dirs(int aid) {
-    char pathname[BUFSIZ_S];
-    sprintf(pathname, "AUCTIONS/%03d", aid);
-    if ((mkdir(pathname, S_IRWXU) == -1) && (errno != EEXIST)) {
-        perror("mkdir");
+int create_auction(start_info_t *auction, int aid) {
+    if (storage->add_hosted(auction->uid, aid) == ERROR) {
+        cancel_auction(aid);
         return ERROR;
     }
 
-    sprintf(pathname, "AUCTIONS/%03d/ASSET", aid);
-    if ((mkdir(pathname, S_IRWXU) == -1) && (errno != EEXIST)) {
-        perror("mkdir");
+    time_t start = time(NULL);
+    if (storage->write_start(aid, auction, start) == ERROR) {
+        cancel_auction(aid);
         return ERROR;
     }
 
-    sprintf(pathname, "AUCTIONS/%03d/BIDS", aid);
-    if ((mkdir(pathname, S_IRWXU) == -1) && (errno != EEXIST)) {
-        perror("mkdir");
-        return ERROR;
+    index_open(aid, auction->uid, start, atol(auction->timeactive), atol(auction->value));
+
+    user_entry_t *user = lock_user(auction->uid);
+    if (user != NULL) {
+        auction_set_add(&user->hosted, aid);
+        index_touch_user(user);
+        index_unlock_user(user);
     }
 
-    return SUCCESS;
+    return aid;
 }
 
-int create_auction_start_file(int aid, start_info_t *auction) {
-    char buffer[BUFSIZ_S];
-    sprintf(buffer, "AUCTIONS/%03d/START_%03d.txt", aid, aid);
-    FILE *file = fopen(buffer, "w");
-    if (file == NULL) {
-        perror("fopen");
-        unlink(auction->fname);
+/**
+ * Builds the auction index from the storage backend. Called once at startup, the index is
+ * kept up to date by every function that changes an auction afterwards.
+*/
+int load_auctions() {
+    bid_info_t bids[RECORD_BIDS_MAX];
+    bid_record_t record;
+
+    if (storage->load_auctions() == ERROR) {
         return ERROR;
     }
 
-    time_t rawtime = time(NULL);
-
-    strftime(buffer, BUFSIZ_S, "%Y-%m-%d %H:%M:%S", localtime(&rawtime));
-    fprintf(file, "%s %s %s %s %s %s %ld",
-        auction->uid, auction->name, auction->fname, auction->value,
-        auction->timeactive, buffer, rawtime
-    );
-    fclose(file);
+    // the bid book, from the bids of every auction in storage order
+    int max_aid = index_next_aid() - 1;
+    for (int aid = 1; aid <= max_aid; aid++) {
+        auction_entry_t *entry = index_get(aid);
+        int state = index_get_state(aid), n_bids, offset = 0;
+        if ((state != ENTRY_OPEN) && (state != ENTRY_CLOSED)) continue;
 
-    return SUCCESS;
-}
-
-int create_auction_hosted_file(int aid, char *uid) {
-    char pathname[BUFSIZ_S];
-    sprintf(pathname, "USERS/%s/HOSTED/%03d.txt", uid, aid);
-    FILE *file = fopen(pathname, "w");
+        do {
+            n_bids = storage->read_bids(aid, bids, offset, RECORD_BIDS_MAX);
+            for (int i = 0; i < n_bids; i++) {
+                strcpy(record.uid, bids[i].uid);
+                record.value = atol(bids[i].value);
+                record.elapsed = atol(bids[i].sec_time);
+                record.time = entry->start + record.elapsed;
+                bidbook_insert(aid, &record);
+            }
+            offset += n_bids;
+        } while (n_bids == RECORD_BIDS_MAX);
 
-    if (file == NULL) {
-        perror("fopen");
-        return ERROR;
+        if (bidbook_max(aid, &record) == SUCCESS) {
+            index_raise_max_bid(aid, record.value, NULL);
+        }
     }
 
-    fclose(file);
     return SUCCESS;
 }
 
+/* ---- Bids ---- */
+
 /**
+ * Accepts the bid only if it is higher than every bid accepted so far, in a single atomic step
+ * on the auction's max bid, and only then writes it to the storage.
  * Returns:
  * - ERROR if a general error occurred.
- * - ERR_WRONG_PASSWORD if user password does not match.
- * - ERR_REACHED_AUCTION_MAX if the number of auctions reached its maximum.
- * - ERR_USER_NOT_LOGGED_IN if user is not logged in.
- * - SUCCESS if auction was successfully created.
+ * - ERR_BID_REFUSED if the bid is not higher than the current max bid.
+ * - SUCCESS if the bid was accepted.
 */
-int create_auction(char *password, start_info_t *auction) {
-    int ret = exists_user_login_file(auction->uid);
-
-    if (ret == ERROR) return ERROR;
-    if (ret == NOT_FOUND) {
-        unlink(auction->fname);
-        return ERR_USER_NOT_LOGGED_IN;
+int add_bid(char *uid, char *aid, long value) {
+    auction_entry_t *entry = index_get(atoi(aid));
+    if (entry == NULL) {
+        return ERROR;
     }
 
-    char buffer[BUFSIZ_S];
-    ret = extract_password(auction->uid, buffer);
-    
-    if (ret != SUCCESS) {
-        unlink(auction->fname);
-        return ret;
+    long prev;
+    if (!index_raise_max_bid(atoi(aid), value, &prev)) {
+        return ERR_BID_REFUSED;
     }
 
-    if (strcmp(password, buffer)) {
-        unlink(auction->fname);
-        return ERR_WRONG_PASSWORD;
+    bid_record_t record = { 0 };
+    strcpy(record.uid, uid);
+    record.value = value;
+    record.time = time(NULL);
+    // seconds elapsed since the start
+    record.elapsed = record.time - entry->start;
+
+    if (storage->add_bid(atoi(aid), &record) == ERROR) {
+        // the bid was never stored, so it must not keep refusing lower ones
+        index_restore_max_bid(atoi(aid), value, prev);
+        return ERROR;
     }
 
-    int next_auction_id = get_next_aid();
+    // a full book falls back to the storage for this auction
+    bidbook_insert(atoi(aid), &record);
 
-    if (next_auction_id == 1000) {
-        unlink(auction->fname);
-        return ERR_REACHED_AUCTION_MAX;
-    }
+    // only once the bid can be read back
+    index_touch_auction(atoi(aid));
+    return SUCCESS;
+}
 
-    if (create_auction_dirs(next_auction_id) == ERROR) {
-        unlink(auction->fname);
-        return ERROR;
+int add_bidded(char *uid, char *aid) {
+    user_entry_t *user = lock_user(uid);
+    if (user == NULL) return ERROR;
+
+    int ret = storage->add_bidded(uid, atoi(aid));
+    if (ret != ERROR) {
+        auction_set_add(&user->bidded, atoi(aid));
+        index_touch_user(user);
     }
 
-    if (create_auction_start_file(next_auction_id, auction) == ERROR) {
-        unlink(auction->fname);
+    index_unlock_user(user);
+    return ret;
+}
+
+/*
+ * Version of everything the record of an auction depends on besides its deadline, and the
+ * moment until which the record stays accurate. Read it before extracting the record.
+*/
+int auction_record_version(char *aid, uint32_t *version, time_t *expires) {
+    auction_entry_t *entry = index_get(atoi(aid));
+    if (entry == NULL) {
         return ERROR;
     }
 
-    if (create_auction_hosted_file(next_auction_id, auction->uid) == ERROR) {
-        unlink(auction->fname);
-        return ERROR;
+    *version = __atomic_load_n(&entry->version, __ATOMIC_ACQUIRE);
+    *expires = (check_auction_state(aid) == OPEN) ? entry->start + entry->timeactive : LONG_MAX;
+    return SUCCESS;
+}
+
+// extract information about up to max bids placed in a given auction, skipping the first offset
+int extract_auctions_bids_info(char *aid, bid_info_t *bids, int offset, int max) {
+    bid_record_t records[max];
+
+    int n_bids = bidbook_read(atoi(aid), records, offset, max);
+    if (n_bids == ERROR) {
+        return storage->read_bids(atoi(aid), bids, offset, max);
     }
 
-    sprintf(buffer, "AUCTIONS/%03d/ASSET/%s", next_auction_id, auction->fname);
-    if (rename(auction->fname, buffer) == -1) {
-        perror("rename");
-        unlink(auction->fname);
-        return ERROR;
+    for (int i = 0; i < n_bids; i++) {
+        bid_record_info(&records[i], &bids[i]);
     }
 
-    return next_auction_id++;
-}
\ No newline at end of file
+    return n_bids;
+}
@@ -1,6 +1,8 @@
 #ifndef _AS_DBFUNC_H_
 #define _AS_DBFUNC_H_
 
+#include <stdint.h>
+#include <sys/types.h>
 #include <time.h>
 
 #include "auction.h"
@@ -16,12 +18,17 @@
 #define ERR_USER_NOT_REGISTERED -3
 #define ERR_WRONG_PASSWORD -4
 #define ERR_REACHED_AUCTION_MAX -5
+#define ERR_AUCTION_EXISTS -6
+#define ERR_BID_REFUSED -7
 
 #define ERR_USER_ALREADY_LOGGED_IN -2
 
 #define CLOSED 3
 #define OPEN 4
 
+#define BIDS_FILES 0
+#define BIDS_LOG 1
+
 typedef struct {
 	char uid[USER_ID_LEN+1];
 	char name[AUCTION_NAME_MAX_LEN+1];
@@ -40,74 +47,105 @@ typedef struct {
 	char sec_time[AUCTION_DURATION_MAX_LEN+1];
 } bid_info_t;
 
+/* Fixed-size form of a bid, as kept by the binary storage engines. */
+typedef struct {
+	char uid[USER_ID_LEN+1];
+	uint32_t value;
+	uint32_t elapsed;
+	int64_t time;
+} bid_record_t;
+
+/* Fixed-size forms of the start and the end of an auction, as kept by the dir backend. */
+typedef struct {
+	char uid[USER_ID_LEN+1];
+	char name[AUCTION_NAME_MAX_LEN+1];
+	char fname[FILE_NAME_MAX_LEN+1];
+	uint32_t value;
+	uint32_t timeactive;
+	int64_t start;
+} start_record_t;
+
+typedef struct {
+	int64_t end;
+	uint32_t elapsed;
+} end_record_t;
+
 typedef struct {
 	char date[DATE_LEN+1];
 	char time[TIME_LEN+1];
 	char sec_time[AUCTION_DURATION_MAX_LEN+1];
 } end_info_t;
 
-int create_user_dir(char *uid);
+int set_storage_backend(char *name);
 
-int erase_dir(char *dirname);
+int init_storage();
 
-int erase_user_dir(char *uid);
+char *storage_name();
 
-int find_user_dir(char *uid);
+char *storage_users_table();
 
-int create_login(char *uid);
+uint64_t storage_generation();
+
+int sync_storage();
+
+int find_user_dir(char *uid);
 
 int erase_login(char *uid);
 
 int exists_user_login_file(char *uid);
 
-int create_password(char *uid, char *pwd);
-
 int extract_password(char *uid, char *ext_pwd);
 
 int erase_password(char *uid);
 
-int exists_user_password_file(char *uid);
-
-int get_asset_file_info(char *aid, char *fname, off_t *fsize);
+int login(char *uid, char *pwd);
 
-int add_user_auction(int next_aid, char *uid);
+int authenticate_user(char *uid, char *pwd);
 
 int create_end_file(char *aid, time_t end_fulltime);
 
 int find_auction(char *aid);
 
-int find_end(char *aid);
-
 int check_auction_state(char *aid);
 
 long get_max_bid_value(char *aid);
 
-int get_next_aid();
+int find_user_auction(char *uid, char *aid);
 
-int add_bid(char *uid, char *aid, long value);
+int user_listing_version(char *uid, uint32_t *version);
 
-// TODO: função mais geral para encontrar ficheiro numa diretoria
+uint32_t listing_version();
 
-int add_bidded(char *uid, char *aid);
+int extract_user_auctions(char *uid, char *auctions, time_t *expires);
 
-int find_user_auction(char *uid, char *aid);
+int extract_user_bidded_auctions(char *uid, char* bidded, time_t *expires);
 
-int extract_user_auctions(char *uid, char *auctions);
-
-int extract_user_bidded_auctions(char *uid, char* bidded);
-
-int extract_auctions(char* auctions);
+int extract_auctions(char* auctions, time_t *expires);
 
 // as três últimas talvez se possam juntar numa só
 
 int extract_auction_start_info(char *aid, start_info_t *start_info);
 
-int extract_auctions_bids_info(char *aid, bid_info_t *bids);
+int auction_record_version(char *aid, uint32_t *version, time_t *expires);
+
+int extract_auctions_bids_info(char *aid, bid_info_t *bids, int offset, int max);
 
 int extract_auction_end_info(char *aid, end_info_t *end_info);
 
-int login(char *uid, char *pwd);
+int reserve_auction();
 
-int create_auction(char *password, start_info_t *auction);
+int cancel_auction(int aid);
+
+int create_asset_file(int aid, char *fname);
+
+int open_asset_file(char *aid, char *fname, off_t *fsize);
+
+int create_auction(start_info_t *auction, int aid);
+
+int load_auctions();
+
+int add_bid(char *uid, char *aid, long value);
+
+int add_bidded(char *uid, char *aid);
 
 #endif
\ No newline at end of file
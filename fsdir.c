@@ -0,0 +1,165 @@
+#define _DEFAULT_SOURCE // DT_DIR
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fsdir.h"
+#include "index.h"
+
+/*
+ * Directory descriptors for the file backends, so that records are opened relative to the
+ * directory holding them instead of resolving USERS/<uid>/... or AUCTIONS/<aid>/... from the
+ * working directory every time. USERS and AUCTIONS stay open for the whole run, and the most
+ * recently used user and auction directories are kept in a small LRU.
+ * The cache is private to each process; descriptors opened before the fork are simply
+ * inherited. User directories are never removed, but an auction directory is erased when its
+ * reservation is cancelled and the ID may be reserved again, so auction entries remember the
+ * generation of the index entry they were opened for and are dropped once it changes.
+ */
+static int users_fd = -1;
+static int auctions_fd = -1;
+
+static fsdir_entry_t cache[FSDIR_CACHE_SIZE];
+static unsigned long clock_tick = 0;
+
+static int open_dir(int dirfd, char *name) {
+    return openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+int fsdir_init(int root_fd) {
+    for (int i = 0; i < FSDIR_CACHE_SIZE; i++) {
+        cache[i].fd = -1;
+    }
+
+    if (((users_fd = open_dir(root_fd, "USERS")) == -1) ||
+            ((auctions_fd = open_dir(root_fd, "AUCTIONS")) == -1)) {
+        perror("openat");
+        return -1;
+    }
+
+    return 0;
+}
+
+int fsdir_users() {
+    return users_fd;
+}
+
+int fsdir_auctions() {
+    return auctions_fd;
+}
+
+static unsigned int auction_generation(int aid) {
+    auction_entry_t *entry = index_get(aid);
+    return (entry == NULL) ? 0 : __atomic_load_n(&entry->generation, __ATOMIC_ACQUIRE);
+}
+
+/* Returns a cached descriptor, opening and caching it on a miss, or -1 (errno set). */
+static int lookup(int kind, int id, unsigned int generation, int parent_fd, char *name) {
+    fsdir_entry_t *victim = &cache[0];
+
+    for (int i = 0; i < FSDIR_CACHE_SIZE; i++) {
+        fsdir_entry_t *entry = &cache[i];
+
+        if ((entry->fd != -1) && (entry->kind == kind) && (entry->id == id)) {
+            if (entry->generation == generation) {
+                entry->used = ++clock_tick;
+                return entry->fd;
+            }
+
+            // opened for an earlier reservation of the same ID
+            close(entry->fd);
+            entry->fd = -1;
+        }
+
+        if ((victim->fd != -1) && ((entry->fd == -1) || (entry->used < victim->used))) {
+            victim = entry;
+        }
+    }
+
+    // misses are not cached, the directory may be created later
+    int fd = open_dir(parent_fd, name);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (victim->fd != -1) {
+        close(victim->fd);
+    }
+
+    victim->kind = kind;
+    victim->id = id;
+    victim->generation = generation;
+    victim->fd = fd;
+    victim->used = ++clock_tick;
+    return fd;
+}
+
+/* Returns the descriptor of USERS/<uid>, or -1 (errno set). */
+int fsdir_user(char *uid) {
+    return lookup(FSDIR_USER, atoi(uid), 0, users_fd, uid);
+}
+
+/* Returns the descriptor of AUCTIONS/<aid>, or -1 (errno set). */
+int fsdir_auction(int aid) {
+    char name[16];
+    sprintf(name, "%03d", aid);
+    return lookup(FSDIR_AUCTION, aid, auction_generation(aid), auctions_fd, name);
+}
+
+void fsdir_forget_auction(int aid) {
+    for (int i = 0; i < FSDIR_CACHE_SIZE; i++) {
+        if ((cache[i].fd != -1) && (cache[i].kind == FSDIR_AUCTION) && (cache[i].id == aid)) {
+            close(cache[i].fd);
+            cache[i].fd = -1;
+        }
+    }
+}
+
+/* Recursively erases dirfd/name. Returns 0 on success or -1. */
+int fsdir_erase(int dirfd, char *name) {
+    int fd = open_dir(dirfd, name);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // fdopendir() takes the descriptor over
+    DIR *d = fdopendir(fd);
+    if (d == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    struct dirent *p;
+    int r = 0;
+    while (!r && (p = readdir(d))) {
+        if (!strcmp(p->d_name, ".") || !strcmp(p->d_name, "..")) {
+            continue;
+        }
+
+        int is_dir = (p->d_type == DT_DIR);
+        if (p->d_type == DT_UNKNOWN) {
+            // not every file system fills d_type in
+            struct stat statbuf;
+            if (fstatat(fd, p->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+                r = -1;
+                break;
+            }
+            is_dir = S_ISDIR(statbuf.st_mode);
+        }
+
+        r = is_dir ? fsdir_erase(fd, p->d_name) : unlinkat(fd, p->d_name, 0);
+    }
+    closedir(d);
+
+    if (!r) {
+        r = unlinkat(dirfd, name, AT_REMOVEDIR);
+    }
+
+    return r;
+}
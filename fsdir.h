@@ -0,0 +1,32 @@
+#ifndef _FSDIR_H_
+#define _FSDIR_H_
+
+#define FSDIR_CACHE_SIZE 32
+
+#define FSDIR_USER 0
+#define FSDIR_AUCTION 1
+
+/* A directory kept open, keyed by what it holds. */
+typedef struct {
+	int kind;
+	int id;
+	unsigned int generation; // of the auction when it was opened
+	int fd; // -1 if the slot is free
+	unsigned long used;
+} fsdir_entry_t;
+
+int fsdir_init(int root_fd);
+
+int fsdir_users();
+
+int fsdir_auctions();
+
+int fsdir_user(char *uid);
+
+int fsdir_auction(int aid);
+
+void fsdir_forget_auction(int aid);
+
+int fsdir_erase(int dirfd, char *name);
+
+#endif
@@ -0,0 +1,291 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "index.h"
+
+/*
+ * The index lives in a shared mapping created before the listeners are forked, so that every
+ * process (UDP workers, TCP listener and its children) sees the same auctions.
+ * Entries are filled in before their state is published, so readers never see a half-written
+ * auction.
+ * Sessions are kept in a users table mapped from a file, so a restart finds them already
+ * loaded. A slot left unknown (new table, or a user never seen) is filled in from the storage
+ * on first use, under a per-user lock that is also held while it is written through. The locks
+ * live in a separate anonymous mapping, since a dead server must not leave them held.
+ */
+static auction_index_t *auction_index = NULL;
+static users_table_t *users_table = NULL;
+static char *user_locks = NULL;
+
+static void raise_max_aid(int aid) {
+    int max_aid = __atomic_load_n(&auction_index->max_aid, __ATOMIC_ACQUIRE);
+
+    while ((aid > max_aid) && !__atomic_compare_exchange_n(&auction_index->max_aid, &max_aid, aid,
+            0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+static void *map_shared(size_t size, int fd) {
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | ((fd == -1) ? MAP_ANONYMOUS : 0),
+        fd, 0);
+
+    if (addr == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    return addr;
+}
+
+/*
+ * Maps the users table from users_path, or from anonymous memory if it is NULL. The table is
+ * only trusted if it was built from the same generation of the storage, a storage recreated
+ * from scratch may reuse UIDs and AIDs for entirely different records.
+ */
+static int map_users_table(char *users_path, uint64_t generation) {
+    if (users_path == NULL) {
+        users_table = map_shared(sizeof(users_table_t), -1);
+        if (users_table == NULL) return -1;
+        users_table->boots = 1;
+        return 0;
+    }
+
+    struct stat statbuf;
+    int fd = open(users_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if ((fd == -1) || (fstat(fd, &statbuf) == -1)) {
+        perror("open");
+        return -1;
+    }
+
+    // laid out as the start of users_table_t
+    struct {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t generation;
+    } header = { 0 };
+    if ((statbuf.st_size == sizeof(users_table_t)) && (pread(fd, &header, sizeof(header), 0) == -1)) {
+        perror("pread");
+    }
+
+    // the table only caches the storage, so one that does not fit is simply rebuilt
+    int fresh = (statbuf.st_size != sizeof(users_table_t)) || (header.magic != USERS_TABLE_MAGIC) ||
+        (header.version != USERS_TABLE_VERSION) || (header.generation != generation);
+    if (fresh && ((ftruncate(fd, 0) == -1) || (ftruncate(fd, sizeof(users_table_t)) == -1))) {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    users_table = map_shared(sizeof(users_table_t), fd);
+    close(fd);
+    if (users_table == NULL) {
+        return -1;
+    }
+
+    if (fresh) {
+        users_table->magic = USERS_TABLE_MAGIC;
+        users_table->version = USERS_TABLE_VERSION;
+        users_table->generation = generation;
+    }
+
+    users_table->boots++;
+    return 0;
+}
+
+int index_init(char *users_path, uint64_t generation) {
+    // anonymous mappings start zeroed
+    if (((auction_index = map_shared(sizeof(auction_index_t), -1)) == NULL) ||
+            ((user_locks = map_shared(MAX_USERS, -1)) == NULL)) {
+        return -1;
+    }
+
+    return map_users_table(users_path, generation);
+}
+
+uint32_t index_boot() {
+    return users_table->boots;
+}
+
+auction_entry_t *index_get(int aid) {
+    if ((aid < 1) || (aid > MAX_AUCTIONS)) return NULL;
+    return &auction_index->auctions[aid];
+}
+
+int index_get_state(int aid) {
+    if ((aid < 1) || (aid > MAX_AUCTIONS)) return ENTRY_FREE;
+    return __atomic_load_n(&auction_index->auctions[aid].state, __ATOMIC_ACQUIRE);
+}
+
+int index_next_aid() {
+    return __atomic_load_n(&auction_index->max_aid, __ATOMIC_ACQUIRE) + 1;
+}
+
+/**
+ * Claims the first free ID after the highest one in use. Claiming is a compare-and-swap on the
+ * entry's state, so concurrent opens never get the same ID and, without contention, it is a
+ * single step. The counter itself is rebuilt from the storage at startup.
+ * Returns:
+ * - the reserved auction ID.
+ * - -1 if every ID is in use.
+*/
+int index_reserve_next() {
+    for (int aid = index_next_aid(); aid <= MAX_AUCTIONS; aid++) {
+        int expected = ENTRY_FREE;
+        if (__atomic_compare_exchange_n(&auction_index->auctions[aid].state, &expected, ENTRY_RESERVED,
+                0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            raise_max_aid(aid);
+            return aid;
+        }
+    }
+
+    return -1;
+}
+
+void index_cancel(int aid) {
+    __atomic_add_fetch(&auction_index->auctions[aid].generation, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&auction_index->auctions[aid].state, ENTRY_FREE, __ATOMIC_RELEASE);
+
+    // give the ID back if it was the last one, so that auction IDs stay contiguous
+    int max_aid = aid;
+    while ((max_aid > 0) && (index_get_state(max_aid) == ENTRY_FREE)) {
+        int prev = max_aid;
+        if (!__atomic_compare_exchange_n(&auction_index->max_aid, &prev, max_aid - 1,
+                0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        max_aid--;
+    }
+}
+
+void index_open(int aid, char *owner, time_t start, long timeactive, long start_value) {
+    auction_entry_t *entry = &auction_index->auctions[aid];
+    strcpy(entry->owner, owner);
+    entry->start = start;
+    entry->timeactive = timeactive;
+    entry->max_bid = start_value;
+    __atomic_store_n(&entry->state, ENTRY_OPEN, __ATOMIC_RELEASE);
+    auction_set_add(&auction_index->open, aid);
+    auction_set_add(&auction_index->existing, aid);
+    __atomic_add_fetch(&auction_index->version, 1, __ATOMIC_RELEASE);
+    raise_max_aid(aid);
+}
+
+void index_close(int aid) {
+    __atomic_store_n(&auction_index->auctions[aid].state, ENTRY_CLOSED, __ATOMIC_RELEASE);
+    index_touch_auction(aid);
+    auction_set_remove(&auction_index->open, aid);
+    __atomic_add_fetch(&auction_index->version, 1, __ATOMIC_RELEASE);
+}
+
+uint32_t index_version() {
+    return __atomic_load_n(&auction_index->version, __ATOMIC_ACQUIRE);
+}
+
+void index_touch_auction(int aid) {
+    __atomic_add_fetch(&auction_index->auctions[aid].version, 1, __ATOMIC_RELEASE);
+}
+
+void index_set_max_bid(int aid, long value) {
+    __atomic_store_n(&auction_index->auctions[aid].max_bid, value, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns 1 if value was higher than the current max bid and replaced it, 0 otherwise. The
+ * replaced value is stored in prev, if given.
+ */
+int index_raise_max_bid(int aid, long value, long *prev) {
+    long *max_bid = &auction_index->auctions[aid].max_bid;
+    long curr = __atomic_load_n(max_bid, __ATOMIC_ACQUIRE);
+
+    // a failed exchange reloads curr, so a concurrent higher bid refuses this one
+    while (value > curr) {
+        if (__atomic_compare_exchange_n(max_bid, &curr, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if (prev) *prev = curr;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Undoes index_raise_max_bid(), unless a higher bid has been accepted since. */
+void index_restore_max_bid(int aid, long value, long prev) {
+    long *max_bid = &auction_index->auctions[aid].max_bid;
+    __atomic_compare_exchange_n(max_bid, &value, prev, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* ---- Auction sets ---- */
+
+void auction_set_add(auction_set_t *set, int aid) {
+    __atomic_or_fetch(&set->words[aid / 64], 1ULL << (aid % 64), __ATOMIC_RELEASE);
+}
+
+void auction_set_remove(auction_set_t *set, int aid) {
+    __atomic_and_fetch(&set->words[aid / 64], ~(1ULL << (aid % 64)), __ATOMIC_RELEASE);
+}
+
+int auction_set_has(auction_set_t *set, int aid) {
+    if ((aid < 1) || (aid > MAX_AUCTIONS)) return 0;
+    return (__atomic_load_n(&set->words[aid / 64], __ATOMIC_ACQUIRE) >> (aid % 64)) & 1;
+}
+
+/* Returns the first AID in the set after the given one, or 0 if there is none. */
+int auction_set_next(auction_set_t *set, int aid) {
+    aid++;
+    for (int i = aid / 64; i < AUCTION_SET_WORDS; i++) {
+        uint64_t word = set->words[i];
+        if (i == aid / 64) {
+            word &= ~0ULL << (aid % 64);
+        }
+
+        if (word) {
+            return i * 64 + __builtin_ctzll(word);
+        }
+    }
+
+    return 0;
+}
+
+/* Copies the auctions that are open or closed, skipping reserved ones. */
+void index_existing(auction_set_t *set) {
+    for (int i = 0; i < AUCTION_SET_WORDS; i++) {
+        set->words[i] = __atomic_load_n(&auction_index->existing.words[i], __ATOMIC_ACQUIRE);
+    }
+}
+
+/* Copies the auctions that were not closed yet, some may have just expired. */
+void index_open_set(auction_set_t *set) {
+    for (int i = 0; i < AUCTION_SET_WORDS; i++) {
+        set->words[i] = __atomic_load_n(&auction_index->open.words[i], __ATOMIC_ACQUIRE);
+    }
+}
+
+/* ---- Users ---- */
+
+/* Returns the locked session of the user, or NULL if the UID is out of range. */
+user_entry_t *index_lock_user(char *uid) {
+    int slot = atoi(uid);
+    if ((slot < 0) || (slot >= MAX_USERS)) return NULL;
+
+    while (__atomic_test_and_set(&user_locks[slot], __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    return &users_table->users[slot];
+}
+
+void index_unlock_user(user_entry_t *user) {
+    __atomic_clear(&user_locks[user - users_table->users], __ATOMIC_RELEASE);
+}
+
+/* Must be called with the user locked, after changing its hosted or bidded set. */
+void index_touch_user(user_entry_t *user) {
+    __atomic_add_fetch(&user->version, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,119 @@
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "auction.h"
+
+#define MAX_AUCTIONS 999
+
+#define ENTRY_FREE 0
+#define ENTRY_RESERVED 1
+#define ENTRY_OPEN 2
+#define ENTRY_CLOSED 3
+
+/* User IDs are 6 digits, so sessions are direct-addressed by UID as well. */
+#define MAX_USERS 1000000
+
+#define SESSION_UNKNOWN 0
+#define SESSION_UNREGISTERED 1
+#define SESSION_REGISTERED 2
+
+/* Summary of an auction, enough to answer most requests without touching the disk. */
+typedef struct {
+	int state;
+	char owner[USER_ID_LEN+1];
+	time_t start;
+	long timeactive;
+	long max_bid;
+	uint32_t version; // bumped by every bid and by the close
+	uint32_t generation; // bumped whenever a reservation is cancelled
+} auction_entry_t;
+
+#define USERS_TABLE_MAGIC 0x55534552 // "USER"
+#define USERS_TABLE_VERSION 5
+
+/* One bit per AID, bit 0 is unused. */
+#define AUCTION_SET_WORDS ((MAX_AUCTIONS + 64) / 64)
+
+typedef struct {
+	uint64_t words[AUCTION_SET_WORDS];
+} auction_set_t;
+
+/* Session of a user, enough to authenticate requests without touching the disk. */
+typedef struct {
+	auction_set_t hosted;
+	auction_set_t bidded;
+	uint32_t version; // bumped whenever hosted or bidded change
+	uint32_t boot; // start of the server hosted was last rebuilt in
+	char state;
+	char logged_in;
+	char pwd[USER_PWD_LEN+1];
+} user_entry_t;
+
+/* Direct-addressed by AID, slot 0 is unused. */
+typedef struct {
+	int max_aid;
+	auction_entry_t auctions[MAX_AUCTIONS+1];
+	auction_set_t existing; // open or closed
+	auction_set_t open;
+	uint32_t version; // bumped whenever an auction opens or closes
+} auction_index_t;
+
+/* Direct-addressed by UID, kept in a sparse file so that untouched slots cost nothing. */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation; // of the storage it was built from
+	uint32_t boots; // bumped by every start of the server
+	user_entry_t users[MAX_USERS];
+} users_table_t;
+
+int index_init(char *users_path, uint64_t generation);
+
+uint32_t index_boot();
+
+auction_entry_t *index_get(int aid);
+
+int index_get_state(int aid);
+
+int index_next_aid();
+
+int index_reserve_next();
+
+void index_cancel(int aid);
+
+void index_open(int aid, char *owner, time_t start, long timeactive, long start_value);
+
+void index_close(int aid);
+
+void index_set_max_bid(int aid, long value);
+
+uint32_t index_version();
+
+void index_touch_auction(int aid);
+
+int index_raise_max_bid(int aid, long value, long *prev);
+
+void index_restore_max_bid(int aid, long value, long prev);
+
+void auction_set_add(auction_set_t *set, int aid);
+
+void auction_set_remove(auction_set_t *set, int aid);
+
+int auction_set_has(auction_set_t *set, int aid);
+
+int auction_set_next(auction_set_t *set, int aid);
+
+void index_existing(auction_set_t *set);
+
+void index_open_set(auction_set_t *set);
+
+user_entry_t *index_lock_user(char *uid);
+
+void index_unlock_user(user_entry_t *user);
+
+void index_touch_user(user_entry_t *user);
+
+#endif
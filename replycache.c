@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "replycache.h"
+
+/*
+ * Serialized LST, LMA, LMB and SRC replies, kept by each UDP worker. A reply is reused while
+ * the versions it was built from are unchanged. For listings, these are the global version,
+ * bumped when an auction opens or closes, and for LMA/LMB the user's own, bumped when its
+ * hosted or bidded set changes. For records, it is the auction's version, bumped by every bid
+ * and by its close. Auctions that expire without being closed yet are covered by the earliest
+ * deadline the reply depends on.
+ * Replies are sent straight from the cache, so a slot handed out in the current batch is not
+ * overwritten until the batch is sent.
+ */
+static cached_reply_t list_cache;
+static cached_reply_t my_auctions_cache[REPLY_CACHE_SLOTS];
+static cached_reply_t my_bids_cache[REPLY_CACHE_SLOTS];
+static cached_reply_t record_cache[REPLY_CACHE_SLOTS];
+
+static uint32_t batch = 1;
+
+void reply_cache_next_batch() {
+    batch++;
+}
+
+cached_reply_t *reply_cache_slot(int kind, char *key) {
+    switch (kind) {
+        case REPLY_CACHE_MY_AUCTIONS:
+            return &my_auctions_cache[atoi(key) % REPLY_CACHE_SLOTS];
+        case REPLY_CACHE_MY_BIDS:
+            return &my_bids_cache[atoi(key) % REPLY_CACHE_SLOTS];
+        case REPLY_CACHE_RECORD:
+            return &record_cache[atoi(key) % REPLY_CACHE_SLOTS];
+        default:
+            return &list_cache;
+    }
+}
+
+int reply_cache_hit(cached_reply_t *slot, char *key, uint32_t version, uint32_t sub_version) {
+    return slot->valid && (slot->key == (key ? atoi(key) : 0)) && (slot->version == version) &&
+        (slot->sub_version == sub_version) && (time(NULL) < slot->expires);
+}
+
+void reply_cache_pin(cached_reply_t *slot) {
+    slot->pinned = batch;
+}
+
+void reply_cache_store(cached_reply_t *slot, char *key, uint32_t version, uint32_t sub_version,
+        time_t expires, char *data, ssize_t len) {
+    if (slot->pinned == batch) return;
+
+    slot->valid = 1;
+    slot->key = key ? atoi(key) : 0;
+    slot->version = version;
+    slot->sub_version = sub_version;
+    slot->expires = expires;
+    slot->len = len;
+    memcpy(slot->data, data, len);
+}
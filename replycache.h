@@ -0,0 +1,42 @@
+#ifndef _REPLYCACHE_H_
+#define _REPLYCACHE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "utils.h"
+
+/* Direct-mapped by UID or AID, collisions simply evict. */
+#define REPLY_CACHE_SLOTS 64
+
+#define REPLY_CACHE_LIST 0
+#define REPLY_CACHE_MY_AUCTIONS 1
+#define REPLY_CACHE_MY_BIDS 2
+#define REPLY_CACHE_RECORD 3
+
+/* A serialized reply and the versions it was built from. */
+typedef struct {
+	int valid;
+	int key;
+	uint32_t version;
+	uint32_t sub_version;
+	time_t expires;
+	uint32_t pinned; // batch whose replies point to data
+	ssize_t len;
+	char data[BUFSIZ_L+8];
+} cached_reply_t;
+
+void reply_cache_next_batch();
+
+cached_reply_t *reply_cache_slot(int kind, char *key);
+
+int reply_cache_hit(cached_reply_t *slot, char *key, uint32_t version, uint32_t sub_version);
+
+void reply_cache_pin(cached_reply_t *slot);
+
+void reply_cache_store(cached_reply_t *slot, char *key, uint32_t version, uint32_t sub_version,
+    time_t expires, char *data, ssize_t len);
+
+#endif
@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "commit.h"
+#include "database.h"
+#include "scheduler.h"
+
+/*
+ * Auctions are closed by a dedicated process instead of whichever request happens to read them
+ * after their deadline. Listeners announce every new auction through a pipe created before they
+ * are forked, and the scheduler keeps the pending deadlines in a min-heap, arming a timerfd for
+ * the earliest one.
+ */
+static int sched_pipe[2] = { -1, -1 };
+
+int scheduler_init() {
+    if (pipe(sched_pipe) == -1) {
+        perror("pipe");
+        return -1;
+    }
+
+    return 0;
+}
+
+void scheduler_add(int aid) {
+    // writes smaller than PIPE_BUF are atomic, so listeners never interleave
+    if (write(sched_pipe[1], &aid, sizeof(aid)) == -1) {
+        perror("write");
+    }
+}
+
+/* ---- Heap ---- */
+
+void heap_push(expiry_heap_t *heap, int aid, time_t deadline) {
+    if (heap->size == MAX_AUCTIONS) return;
+
+    int i = heap->size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap->entries[parent].deadline <= deadline) break;
+        heap->entries[i] = heap->entries[parent];
+        i = parent;
+    }
+
+    heap->entries[i].deadline = deadline;
+    heap->entries[i].aid = aid;
+}
+
+void heap_pop(expiry_heap_t *heap) {
+    expiry_t last = heap->entries[--heap->size];
+
+    int i = 0;
+    while (2*i + 1 < heap->size) {
+        int child = 2*i + 1;
+        if ((child + 1 < heap->size) && (heap->entries[child+1].deadline < heap->entries[child].deadline)) {
+            child++;
+        }
+        if (last.deadline <= heap->entries[child].deadline) break;
+        heap->entries[i] = heap->entries[child];
+        i = child;
+    }
+
+    heap->entries[i] = last;
+}
+
+/* ---- Scheduler ---- */
+
+void schedule_auction(expiry_heap_t *heap, int aid) {
+    auction_entry_t *entry = index_get(aid);
+    if ((entry == NULL) || (index_get_state(aid) != ENTRY_OPEN)) return;
+
+    heap_push(heap, aid, entry->start + entry->timeactive);
+}
+
+void expire_auctions(expiry_heap_t *heap) {
+    char aid_str[AUCTION_ID_BUFSIZ];
+    time_t now = time(NULL);
+
+    while ((heap->size > 0) && (heap->entries[0].deadline <= now)) {
+        expiry_t next = heap->entries[0];
+        heap_pop(heap);
+
+        // it may have been closed by its owner in the meantime
+        if (index_get_state(next.aid) != ENTRY_OPEN) continue;
+
+        sprintf(aid_str, "%03d", next.aid);
+        if (create_end_file(aid_str, next.deadline) == ERROR) {
+            printf("ERROR\n");
+        } else if (commit_enabled()) {
+            // nobody waits for it, it just joins the next flush
+            commit_request();
+        }
+    }
+}
+
+int arm_timer(int timerfd, expiry_heap_t *heap) {
+    // an all-zero value disarms the timer while there is nothing to wait for
+    struct itimerspec spec = { 0 };
+
+    if (heap->size > 0) {
+        spec.it_value.tv_sec = heap->entries[0].deadline;
+    }
+
+    return timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+void scheduler_run() {
+    static expiry_heap_t heap;
+    int aids[64];
+    uint64_t expirations;
+
+    // only listeners announce auctions, so end of file means they are gone
+    close(sched_pipe[1]);
+
+    int timerfd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+    if (timerfd == -1) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+
+    // auctions restored from disk at startup
+    int max_aid = index_next_aid() - 1;
+    for (int aid = 1; aid <= max_aid; aid++) {
+        schedule_auction(&heap, aid);
+    }
+
+    struct pollfd fds[2] = {
+        { .fd = sched_pipe[0], .events = POLLIN },
+        { .fd = timerfd, .events = POLLIN }
+    };
+
+    while (1) {
+        expire_auctions(&heap);
+
+        if (arm_timer(timerfd, &heap) == -1) {
+            perror("timerfd_settime");
+            exit(EXIT_FAILURE);
+        }
+
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        if (fds[1].revents & POLLIN) {
+            if (read(timerfd, &expirations, sizeof(expirations)) == -1) {
+                perror("read");
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(sched_pipe[0], aids, sizeof(aids));
+            if (n == 0) {
+                exit(EXIT_SUCCESS);
+            } else if (n == -1) {
+                perror("read");
+                continue;
+            }
+
+            for (ssize_t i = 0; i < n / (ssize_t) sizeof(int); i++) {
+                schedule_auction(&heap, aids[i]);
+            }
+        }
+    }
+}
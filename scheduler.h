@@ -0,0 +1,26 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <time.h>
+
+#include "index.h"
+
+/* Pending expiry of an open auction. */
+typedef struct {
+	time_t deadline;
+	int aid;
+} expiry_t;
+
+/* Min-heap ordered by deadline, every open auction appears at most once. */
+typedef struct {
+	int size;
+	expiry_t entries[MAX_AUCTIONS];
+} expiry_heap_t;
+
+int scheduler_init();
+
+void scheduler_add(int aid);
+
+void scheduler_run();
+
+#endif
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 #define _DEFAULT_SOURCE
+#define _GNU_SOURCE // accept4()
 
 #include <stdio.h>
 #include <sys/types.h>
@@ -15,6 +16,7 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 
 /* Signals */
 #include <signal.h>
@@ -25,6 +27,12 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include "database.h"
+#include "index.h"
+#include "bidbook.h"
+#include "scheduler.h"
+#include "storage.h"
+#include "commit.h"
+#include "replycache.h"
 
 /* Auction Protocol */
 #include "auction.h"
@@ -37,48 +45,174 @@
 
 #define PORT_FLAG "-p"
 #define VERB_FLAG "-v"
+#define MODE_FLAG "-m"
+#define WORKERS_FLAG "-w"
+#define BIDS_FLAG "-b"
+#define STORAGE_FLAG "-s"
+#define COMMIT_WINDOW_FLAG "-d"
+#define COMMIT_RECORDS_FLAG "-c"
+
+#define MODE_EPOLL "epoll"
+#define MODE_FORK "fork"
+
+#define BIDS_FILES_NAME "files"
+#define BIDS_LOG_NAME "log"
 
 #define DEFAULT_PORT 58019
 
 #define SOCKET_TIMEOUT_SECONDS 1
 
+#define EPOLL_MAX_EVENTS 64
+#define UDP_BATCH_SIZE 32
+
 int verbose = 0;
+int use_epoll = 1;
+int udp_workers = 1;
+long commit_window_us = -1;
+int commit_records = COMMIT_DEFAULT_RECORDS;
+
+/* ---- Connections ---- */
+
+#define CONN_REQUEST 0
+#define CONN_ASSET 1
+#define CONN_COMMIT 2
+#define CONN_REPLY 3
+#define CONN_DRAIN 4
+#define CONN_CLOSED 5
+
+struct connection;
+
+/*
+ * Doubly linked list of connections, used by the epoll loop to track the ones waiting on the
+ * client (ordered by deadline) and the ones waiting on a flush (ordered by ticket).
+ */
+typedef struct {
+    struct connection *head;
+    struct connection *tail;
+} connection_list_t;
+
+/*
+ * State of a TCP connection. Requests are received, processed and replied to in steps, so that
+ * the same handlers can be resumed by the epoll loop whenever the socket becomes ready again,
+ * or simply run to completion by a forked child on a blocking socket.
+ */
+typedef struct connection {
+    int fd;
+    int state;
+    struct sockaddr addr;
+    socklen_t addrlen;
+
+    /* Idle timeout bookkeeping (epoll mode only) */
+    long deadline;
+    uint32_t events; // 0 while out of the epoll set
+    connection_list_t *list;
+    struct connection *prev;
+    struct connection *next;
+
+    /* Request being received */
+    char buffer[BUFSIZ_L+1];
+    ssize_t received;
+
+    /* Asset being uploaded (OPA) into a reserved auction, or discarded after an early reply */
+    start_info_t auction;
+    int aid;
+    int upload_fd;
+    off_t remaining;
+    int drain;
+
+    /* Reply held until the mutation it reports is durable (-d) */
+    uint32_t ticket;
+
+    /* Reply being sent, optionally followed by an asset (SAS) */
+    char reply[BUFSIZ_S];
+    ssize_t reply_len;
+    ssize_t reply_sent;
+    int asset_fd;
+    off_t asset_offset;
+    off_t asset_size;
+} connection_t;
+
+void reply(connection_t *conn, char *msg, ssize_t len) {
+    memcpy(conn->reply, msg, len);
+    conn->reply_len = len;
+    conn->reply_sent = 0;
+    conn->state = CONN_REPLY;
+}
+
+/* Replies before the rest of the request, unread bytes included, has been received. */
+void reply_early(connection_t *conn, char *msg, ssize_t len, off_t unread) {
+    reply(conn, msg, len);
+    conn->remaining = (unread > 0) ? unread : 0;
+    conn->drain = 1;
+}
+
+/* Holds the reply prepared so far until a flush covers the mutations made before it. */
+void commit_reply(connection_t *conn) {
+    if (commit_enabled()) {
+        conn->ticket = commit_request();
+        conn->state = CONN_COMMIT;
+    }
+}
+
+/* ---- Datagrams ---- */
+
+/* A UDP request and the reply to be sent back to the address it came from. */
+typedef struct {
+    struct sockaddr addr;
+    socklen_t addrlen;
+
+    char buffer[BUFSIZ_S+1];
+    ssize_t received;
+
+    char reply[BUFSIZ_L+8];
+    ssize_t reply_len;
+
+    // either reply or a cached listing
+    char *reply_data;
+} datagram_t;
+
+void reply_datagram(datagram_t *dgram, char *msg, ssize_t len) {
+    memcpy(dgram->reply, msg, len);
+    dgram->reply_len = len;
+}
+
+/* Sends a cached listing as is, without copying it. */
+void reply_cached(datagram_t *dgram, cached_reply_t *cached) {
+    reply_cache_pin(cached);
+    dgram->reply_data = cached->data;
+    dgram->reply_len = cached->len;
+}
 
 /* ---- Responses ---- */
 
-void response_login(int fd, char *uid, char *pwd) {
+void response_login(datagram_t *dgram, char *uid, char *pwd) {
     if (!validate_user_id(uid) || !validate_user_password(pwd)) {
-        send(fd, "RLI ERR\n", 8, 0);
+        reply_datagram(dgram, "RLI ERR\n", 8);
         return;
     }
     
     switch (login(uid, pwd)) {
         case USER_REGISTERED:
-            send(fd, "RLI REG\n", 8, 0);
+            reply_datagram(dgram, "RLI REG\n", 8);
             break;
         case USER_LOGGED_IN:
-            send(fd, "RLI OK\n", 7, 0);
+            reply_datagram(dgram, "RLI OK\n", 7);
             break;
         default:
-            send(fd, "RLI NOK\n", 8, 0);
+            reply_datagram(dgram, "RLI NOK\n", 8);
             break;
     }
 }
 
-void response_logout(int fd, char *uid, char *pwd) {
+void response_logout(datagram_t *dgram, char *uid, char *pwd) {
     if (!validate_user_id(uid) || !validate_user_password(pwd)) {
-        if (send(fd, "RLI ERR\n", 8, 0) == -1) {
-            printf("ERROR\n");
-            return;
-        }
+        reply_datagram(dgram, "RLO ERR\n", 8);
+        return;
     }
 
     int ret = find_user_dir(uid);
     if (ret == NOT_FOUND) {
-        if (send(fd, "RLO UNR\n", 8, 0) == -1) {
-            printf("ERROR\n");
-            return;
-        }
+        reply_datagram(dgram, "RLO UNR\n", 8);
     } else if (ret == SUCCESS) {
         char ext_pwd[USER_PWD_LEN+1];
         extract_password(uid, ext_pwd);
@@ -86,40 +220,29 @@ void response_logout(int fd, char *uid, char *pwd) {
             int ret2 = exists_user_login_file(uid);
             if (ret2 == SUCCESS) {
                 erase_login(uid);
-                if (send(fd, "RLO OK\n", 7, 0) == -1) {
-                    printf("ERROR\n");
-                    return;
-                }
+                reply_datagram(dgram, "RLO OK\n", 7);
             } else if (ret2 == NOT_FOUND) {
-                if (send(fd, "RLO NOK\n", 8, 0) == -1) {
-                    printf("ERROR\n");
-                    return;
-                }
+                reply_datagram(dgram, "RLO NOK\n", 8);
             } else if (ret2 == ERROR) {
                 printf("ERROR\n");
             }
         } else {
-            if (send(fd, "RLO ERR\n", 8, 0) == -1) {
-                printf("ERROR\n");
-                return;
-            }
+            reply_datagram(dgram, "RLO ERR\n", 8);
         }
     } else if (ret == ERROR) {
         printf("ERROR\n");
     }
 }
 
-void response_unregister(int fd, char *uid, char *pwd) {
+void response_unregister(datagram_t *dgram, char *uid, char *pwd) {
     if (!validate_user_id(uid) || !validate_user_password(pwd)) {
-        if (send(fd, "RUR ERR\n", 8, 0) == -1) {
-            printf("ERROR\n");
-            return;
-        }
+        reply_datagram(dgram, "RUR ERR\n", 8);
+        return;
     }
 
     int ret = find_user_dir(uid);
     if (ret == NOT_FOUND) {
-        send(fd, "RUR UNR\n", 8, 0);
+        reply_datagram(dgram, "RUR UNR\n", 8);
     } else if (ret == SUCCESS) {
         char ext_pwd[USER_PWD_LEN+1];
         extract_password(uid, ext_pwd);
@@ -128,77 +251,60 @@ void response_unregister(int fd, char *uid, char *pwd) {
             if (ret2 == SUCCESS) {
                 erase_password(uid);
                 erase_login(uid);
-                send(fd, "RUR OK\n", 7, 0);
+                reply_datagram(dgram, "RUR OK\n", 7);
             } else if (ret2 == NOT_FOUND) {
-                send(fd, "RUR NOK\n", 8, 0);
+                reply_datagram(dgram, "RUR NOK\n", 8);
             } else if (ret2 == ERROR) {
                 printf("ERROR\n");
             }
         } else {
-            if (send(fd, "RUR ERR\n", 8, 0) == -1) {
-                printf("ERROR\n");
-                return;
-            }
+            reply_datagram(dgram, "RUR ERR\n", 8);
         }
     } else if (ret == ERROR) {
         printf("ERROR\n");
     }
 }
 
-void response_close(int fd, char *uid, char *pwd, char *aid) {
+void response_close(connection_t *conn, char *uid, char *pwd, char *aid) {
     int ret = exists_user_login_file(uid);
     if (ret == ERROR) {
         printf("ERROR\n");
         return;
     } else if (ret == NOT_FOUND) {
-        write_all_bytes(fd, "RCL NLG\n", 8);
+        reply(conn, "RCL NLG\n", 8);
     } else if (ret == SUCCESS) {
         char ext_pwd[USER_PWD_LEN+1];
         extract_password(uid, ext_pwd);
         if (strcmp(pwd, ext_pwd)) {
-            if (write_all_bytes(fd, "RCL ERR\n", 8) == -1) {
-                printf("ERROR\n");
-                return;
-            }
+            reply(conn, "RCL ERR\n", 8);
         } else {
             int ret2 = find_auction(aid);
             if (ret2 == ERROR) {
                 printf("ERROR\n");
                 return;
             } else if (ret2 == NOT_FOUND) {
-                if (write_all_bytes(fd, "RCL EAU\n", 8) == -1) {
-                    printf("ERROR\n");
-                    return;
-                }
+                reply(conn, "RCL EAU\n", 8);
             } else if (ret2 == SUCCESS) {
                 int ret3 = find_user_auction(uid, aid);
                 if (ret3 == ERROR) {
                     printf("ERROR\n");
                     return;
                 } else if (ret3 == NOT_FOUND) {
-                    if (write_all_bytes(fd, "RCL EOW\n", 8) == -1) {
-                        printf("ERROR\n");
-                        return;
-                    }
+                    reply(conn, "RCL EOW\n", 8);
                 } else if (ret3 == SUCCESS) {
                     int state = check_auction_state(aid);
                     if (state == ERROR) {
                         printf("ERROR\n");
                         return;
                     } else if (state == CLOSED) {
-                        if (write_all_bytes(fd, "RCL END\n", 8) == -1) {
-                            printf("ERROR\n");
-                            return;
-                        }
+                        reply(conn, "RCL END\n", 8);
                     } else if (state == OPEN) {
                         time_t curr_fulltime;
                         time(&curr_fulltime);
                         create_end_file(aid, curr_fulltime);
 
-                        if (write_all_bytes(fd, "RCL OK\n", 7) == -1) {
-                            printf("ERROR\n");
-                            return;
-                        }
+                        reply(conn, "RCL OK\n", 7);
+                        commit_reply(conn);
                     }
                     
                 }
@@ -207,12 +313,10 @@ void response_close(int fd, char *uid, char *pwd, char *aid) {
     }
 }
 
-void response_myauctions(int fd, char *uid) {
+void response_myauctions(datagram_t *dgram, char *uid) {
     if (!validate_user_id(uid)) {
-        if (send(fd, "RMA ERR\n", 8, 0) == -1) {
-            printf("ERROR\n");
-            return;
-        }
+        reply_datagram(dgram, "RMA ERR\n", 8);
+        return;
     }
 
     int ret = exists_user_login_file(uid);
@@ -220,38 +324,38 @@ void response_myauctions(int fd, char *uid) {
         printf("ERROR\n");
         return;
     } else if (ret == NOT_FOUND) {
-        if (send(fd, "RMA NLG\n", 8, 0) == -1) {
+        reply_datagram(dgram, "RMA NLG\n", 8);
+    } else if (ret == SUCCESS) {
+        uint32_t auctions_version = listing_version(), user_version;
+        if (user_listing_version(uid, &user_version) == ERROR) {
             printf("ERROR\n");
             return;
         }
-    } else if (ret == SUCCESS) {
+
+        cached_reply_t *cached = reply_cache_slot(REPLY_CACHE_MY_AUCTIONS, uid);
+        if (reply_cache_hit(cached, uid, auctions_version, user_version)) {
+            reply_cached(dgram, cached);
+            return;
+        }
+
         char auctions[BUFSIZ_L];
+        time_t expires;
         memset(auctions, 0, BUFSIZ_L);
-        int count = extract_user_auctions(uid, auctions);
-        if (!count) {
-            if (send(fd, "RMA NOK\n", 8, 0) == -1) {
-                printf("ERROR\n");
-                return;
-            }
+        int count = extract_user_auctions(uid, auctions, &expires);
+        if (count <= 0) {
+            reply_datagram(dgram, "RMA NOK\n", 8);
         } else {
-            char buffer[BUFSIZ_L+8];
-            memset(buffer, 0, BUFSIZ_L+8);
-            sprintf(buffer, "RMA OK%s\n", auctions);
-            if (send(fd, buffer, strlen(buffer), 0) == -1) {
-                printf("ERROR4\n");
-                return;
-            }
+            dgram->reply_len = sprintf(dgram->reply, "RMA OK%s\n", auctions);
         }
 
+        reply_cache_store(cached, uid, auctions_version, user_version, expires, dgram->reply, dgram->reply_len);
     }
 }
 
-void response_mybids(int fd, char *uid) {
+void response_mybids(datagram_t *dgram, char *uid) {
     if (!validate_user_id(uid)) {
-        if (send(fd, "RMB ERR\n", 8, 0) == -1) {
-            printf("ERROR\n");
-            return;
-        }
+        reply_datagram(dgram, "RMB ERR\n", 8);
+        return;
     }
 
     int ret = exists_user_login_file(uid);
@@ -259,158 +363,168 @@ void response_mybids(int fd, char *uid) {
         printf("ERROR\n");
         return;
     } else if (ret == NOT_FOUND) {
-        if (send(fd, "RMB NLG\n", 8, 0) == -1) {
+        reply_datagram(dgram, "RMB NLG\n", 8);
+    } else if (ret == SUCCESS) {
+        uint32_t auctions_version = listing_version(), user_version;
+        if (user_listing_version(uid, &user_version) == ERROR) {
             printf("ERROR\n");
             return;
         }
-    } else if (ret == SUCCESS) {
+
+        cached_reply_t *cached = reply_cache_slot(REPLY_CACHE_MY_BIDS, uid);
+        if (reply_cache_hit(cached, uid, auctions_version, user_version)) {
+            reply_cached(dgram, cached);
+            return;
+        }
+
         char auctions[BUFSIZ_L];
+        time_t expires;
         memset(auctions, 0, BUFSIZ_L);
-        int count = extract_user_bidded_auctions(uid, auctions);
-        if (!count) {
-            if (send(fd, "RMB NOK\n", 8, 0) == -1) {
-                printf("ERROR\n");
-                return;
-            }
+        int count = extract_user_bidded_auctions(uid, auctions, &expires);
+        if (count <= 0) {
+            reply_datagram(dgram, "RMB NOK\n", 8);
         } else {
-            char buffer[BUFSIZ_L+8];
-            memset(buffer, 0, BUFSIZ_L+8);
-            sprintf(buffer, "RMB OK%s\n", auctions);
-            if (send(fd, buffer, strlen(buffer), 0) == -1) {
-                printf("ERROR4\n");
-                return;
-            }
+            dgram->reply_len = sprintf(dgram->reply, "RMB OK%s\n", auctions);
         }
 
+        reply_cache_store(cached, uid, auctions_version, user_version, expires, dgram->reply, dgram->reply_len);
     }
 }
 
-void response_list(int fd) {
+void response_list(datagram_t *dgram) {
+    uint32_t auctions_version = listing_version();
+
+    cached_reply_t *cached = reply_cache_slot(REPLY_CACHE_LIST, NULL);
+    if (reply_cache_hit(cached, NULL, auctions_version, 0)) {
+        reply_cached(dgram, cached);
+        return;
+    }
+
     char auctions[BUFSIZ_L];
+    time_t expires;
     memset(auctions, 0, BUFSIZ_L);
-    int count = extract_auctions(auctions);
-    if (!count) {
-        if (send(fd, "RLS NOK\n", 8, 0) == -1) {
-            printf("ERROR\n");
-            return;
-        }
+    int count = extract_auctions(auctions, &expires);
+    if (count <= 0) {
+        reply_datagram(dgram, "RLS NOK\n", 8);
     } else {
-        char buffer[BUFSIZ_L+8];
-        memset(buffer, 0, BUFSIZ_L+8);
-        sprintf(buffer, "RLS OK%s\n", auctions);
-        if (send(fd, buffer, strlen(buffer), 0) == -1) {
-            printf("ERROR4\n");
-            return;
-        }
+        dgram->reply_len = sprintf(dgram->reply, "RLS OK%s\n", auctions);
     }
+
+    reply_cache_store(cached, NULL, auctions_version, 0, expires, dgram->reply, dgram->reply_len);
 }
 
-void response_show_asset(int fd, char *aid) {
+void response_show_asset(connection_t *conn, char *aid) {
     // Message: SAS <aid>
     int ret = find_auction(aid);
     
     if (ret == NOT_FOUND) {
-        write_all_bytes(fd, "RSA NOK\n", 8);
+        reply(conn, "RSA NOK\n", 8);
         return;
     }
     
     char fname[FILE_NAME_MAX_LEN+1];
     off_t fsize = 0;
-    if (get_asset_file_info(aid, fname, &fsize) == ERROR) {
-        printf("ERROR\n");
-        return;
-    }
-
-    char buffer[BUFSIZ_S];
-    ssize_t printed = sprintf(buffer, "RSA OK %s %ld ", fname, fsize);
-    if (write_all_bytes(fd, buffer, printed) == -1) {
-        printf("ERROR\n");
-        return;
-    }
-
-    sprintf(buffer, "AUCTIONS/%s/ASSET/%s", aid, fname);
-    FILE *file = fopen(buffer, "r");
-    if (file == NULL) {
-        printf("ERROR\n");
-        return;
-    }
-
-    if (write_file_data(fd, file, fsize) > 0) {
-        printf("ERROR1\n");
+    int assetfd = open_asset_file(aid, fname, &fsize);
+    if (assetfd == -1) {
+        printf(ERROR_OPEN);
         return;
     }
 
-    if (write_all_bytes(fd, "\n", 1) == -1) {
-        printf("ERROR2\n");
-        return;
-    }
-
-    fclose(file);
+    // the asset itself is streamed by tcp_send_reply() after the header
+    conn->reply_len = sprintf(conn->reply, "RSA OK %s %ld ", fname, fsize);
+    conn->reply_sent = 0;
+    conn->asset_fd = assetfd;
+    conn->asset_offset = 0;
+    conn->asset_size = fsize;
+    conn->state = CONN_REPLY;
 }
 
-void response_bid(int fd, char *uid, char *pwd, char *aid, char *value_str) {
-    int ret = exists_user_login_file(uid);
+void response_bid(connection_t *conn, char *uid, char *pwd, char *aid, char *value_str) {
+    // login and password in a single session lookup
+    int ret = authenticate_user(uid, pwd);
     int ret2 = find_auction(aid);
 
     if (ret == ERROR || ret2 == ERROR) {
-        printf("ERROR\n");
+        reply(conn, "RBD ERR\n", 8);
         return;
     }
     
-    if (ret == NOT_FOUND) {
-        write_all_bytes(fd, "RBD NLG\n", 8);
+    if (ret == ERR_USER_NOT_LOGGED_IN) {
+        reply(conn, "RBD NLG\n", 8);
         return;
     }
     
     if (ret2 == NOT_FOUND) {
-        write_all_bytes(fd, "RBD NOK\n", 8);
+        reply(conn, "RBD NOK\n", 8);
         return;
     }
     
     // a partir sabemos que o cliente está logged in e o auction existe
-    char ext_pwd[USER_PWD_LEN+1];
-    extract_password(uid, ext_pwd);
-    if (strcmp(pwd, ext_pwd)) {
-        write_all_bytes(fd, "RBD ERR\n", 8);
+    if (ret == ERR_WRONG_PASSWORD) {
+        reply(conn, "RBD ERR\n", 8);
         return;
     }
     
     int ret3 = find_user_auction(uid, aid);
     if (ret3 == ERROR) {
-        printf("ERROR\n");
+        reply(conn, "RBD ERR\n", 8);
         return;
     }
     
     if (ret3 == SUCCESS) {
-        write_all_bytes(fd, "RBD ILG\n", 8);
+        reply(conn, "RBD ILG\n", 8);
         return;
     }
     
     // a partir daqui sabemos que o auction não pertence ao cliente
     if (check_auction_state(aid) == CLOSED) {
-        write_all_bytes(fd, "RBD NOK\n", 8);
+        reply(conn, "RBD NOK\n", 8);
         return;
     }
 
     // a partir daqui sabemos que o auction está aberto
     int value = atoi(value_str);
+
+    // most bids lose during a bidding war, refuse them against the max bid before contending for it
     if (value <= get_max_bid_value(aid)) {
-        write_all_bytes(fd, "RBD REF\n", 8);
-    } else { // bid aceite
-        write_all_bytes(fd, "RBD ACC\n", 8);
-        add_bid(uid, aid, value);
-        add_bidded(uid, aid);
+        reply(conn, "RBD REF\n", 8);
+        return;
+    }
+
+    switch (add_bid(uid, aid, value)) {
+        case ERR_BID_REFUSED:
+            reply(conn, "RBD REF\n", 8);
+            break;
+        case SUCCESS: // bid aceite
+            add_bidded(uid, aid);
+            reply(conn, "RBD ACC\n", 8);
+            commit_reply(conn);
+            break;
+        default: // falha do armazenamento
+            reply(conn, "RBD ERR\n", 8);
+            break;
     }
 }
 
-void response_show_record(int fd, char *aid) {
+/*
+ * Message: SRC <aid> [<offset> [<limit>]]
+ * Without an offset, the first RECORD_BIDS_DEFAULT bids are sent as before. With one, up to
+ * limit bids starting at the offset-th are sent, followed by "M <next_offset>" if there are more.
+ */
+void response_show_record(datagram_t *dgram, char *aid, char *offset_str, char *limit_str) {
     ssize_t total_printed = 0, printed = 0;
+    int paged = (offset_str != NULL);
+    int offset = 0, limit = RECORD_BIDS_DEFAULT;
     
-    if (!validate_auction_id(aid)) {
-        if (send(fd, "RRC ERR\n", 8, 0) == -1) {
-            printf("ERROR\n");
-            return;
-        }
+    if (!validate_auction_id(aid) || (paged && !validate_record_offset(offset_str)) ||
+            (limit_str && !validate_record_limit(limit_str))) {
+        reply_datagram(dgram, "RRC ERR\n", 8);
+        return;
+    }
+
+    if (paged) {
+        offset = atoi(offset_str);
+        limit = limit_str ? atoi(limit_str) : RECORD_BIDS_DEFAULT;
     }
 
     int ret = find_auction(aid);
@@ -418,13 +532,23 @@ void response_show_record(int fd, char *aid) {
         printf("ERROR\n");
         return;
     } else if (ret == NOT_FOUND) {
-        if (send(fd, "RRC NOK\n", 8, 0) == -1) {
+        reply_datagram(dgram, "RRC NOK\n", 8);
+    } else if (ret == SUCCESS) {
+        uint32_t version;
+        time_t expires;
+        if (auction_record_version(aid, &version, &expires) == ERROR) {
             printf("ERROR\n");
             return;
         }
-    } else if (ret == SUCCESS) {
-        char buffer[BUFSIZ_L];
-        memset(buffer, 0, BUFSIZ_L);
+
+        // identical requests in the same batch, or until the next bid or close, share the reply
+        cached_reply_t *cached = reply_cache_slot(REPLY_CACHE_RECORD, aid);
+        if (!paged && reply_cache_hit(cached, aid, version, 0)) {
+            reply_cached(dgram, cached);
+            return;
+        }
+
+        char *buffer = dgram->reply;
 
         start_info_t start_info;
         extract_auction_start_info(aid, &start_info);
@@ -432,25 +556,33 @@ void response_show_record(int fd, char *aid) {
             start_info.fname, start_info.value, start_info.date, start_info.time, start_info.timeactive);
         total_printed += printed;
 
-        bid_info_t bids[50];
-        int n_bids = extract_auctions_bids_info(aid, bids);
+        // one more than the window tells whether there is a next page
+        bid_info_t bids[RECORD_BIDS_MAX+1];
+        int n_bids = extract_auctions_bids_info(aid, bids, offset, limit + paged);
+        int more = paged && (n_bids > limit);
+        if (more) n_bids = limit;
+
         for (int i = 0; i < n_bids; i++) {
             printed = sprintf(buffer+total_printed, " B %s %s %s %s %s",
                 bids[i].uid, bids[i].value, bids[i].date, bids[i].time, bids[i].sec_time);
             total_printed += printed;
         }
 
+        if (more) {
+            total_printed += sprintf(buffer+total_printed, " M %d", offset + n_bids);
+        }
+
         if (check_auction_state(aid) == CLOSED) {
             end_info_t end_info;
             extract_auction_end_info(aid, &end_info);
             printed = sprintf(buffer+total_printed, " E %s %s %s", end_info.date, end_info.time, end_info.sec_time);
             total_printed += printed;
         }
-        buffer[total_printed] = '\n';
-        
-        if (send(fd, buffer, strlen(buffer), 0) == -1) {
-            printf("ERROR\n");
-            return;
+        buffer[total_printed++] = '\n';
+        dgram->reply_len = total_printed;
+
+        if (!paged) {
+            reply_cache_store(cached, aid, version, 0, expires, dgram->reply, dgram->reply_len);
         }
     }
 }
@@ -476,13 +608,33 @@ void print_verbose(char *uid, char *type, struct sockaddr *addr, socklen_t addrl
     }
 }
 
-void tcp_command_choser(int fd, struct sockaddr *client_addr, socklen_t client_addrlen) {
-    char buffer[BUFSIZ_L+1];
-    ssize_t received = read_all_bytes(fd, buffer, BUFSIZ_L);
-    if (received == -1) {
-        perror("read");
+void tcp_command_open(connection_t *conn, char *trailer, ssize_t length) {
+    close(conn->upload_fd);
+    conn->upload_fd = -1;
+
+    if ((length != 1) || (*trailer != '\n')) {
+        reply(conn, "ROA ERR\n", 8);
         return;
     }
+
+    // the reservation is either turned into an auction or cancelled by create_auction()
+    int aid = create_auction(&conn->auction, conn->aid);
+    conn->aid = 0;
+
+    if (aid > 0) {
+        scheduler_add(aid);
+        conn->reply_len = sprintf(conn->reply, "ROA OK %03d\n", aid);
+        conn->reply_sent = 0;
+        conn->state = CONN_REPLY;
+        commit_reply(conn);
+    } else {
+        reply(conn, "ROA NOK\n", 8);
+    }
+}
+
+void tcp_command_choser(connection_t *conn) {
+    char *buffer = conn->buffer;
+    ssize_t received = conn->received;
     buffer[received] = '\0';
     char *ptr = buffer;
     char *delim = " ";
@@ -498,233 +650,519 @@ void tcp_command_choser(int fd, struct sockaddr *client_addr, socklen_t client_a
         char *fname = strsep(&ptr, delim);
         char *fsize = strsep(&ptr, delim);
         char *fdata = ptr;
-        print_verbose(uid, request, client_addr, client_addrlen);
+        print_verbose(uid, request, &conn->addr, conn->addrlen);
 
         if (!validate_user_id(uid) || !validate_user_password(pwd) ||
                 !validate_auction_name(name) || !validate_auction_value(start_value) ||
                 !validate_auction_duration(timeactive) || !validate_file_name(fname) ||
                 !validate_file_size(fsize) || (ptr == NULL) || (ptr - buffer > received)) {
-            write_all_bytes(fd, "ROA ERR\n", 4);
+            reply(conn, "ROA ERR\n", 8);
             return;
         }
 
-        FILE *file = fopen(fname, "w");
-        if (!file) {
-            printf(ERROR_OPEN);
-            return;
-        }
+        strcpy(conn->auction.uid, uid);
+        strcpy(conn->auction.name, name);
+        strcpy(conn->auction.value, start_value);
+        strcpy(conn->auction.timeactive, timeactive);
+        strcpy(conn->auction.fname, fname);
 
-        received = (buffer + received) - fdata;
+        // requests that are going to be refused are answered before the asset is received,
+        // which is then discarded (asset and end of line) instead of being stored
+        off_t unread = atol(fsize) + 1 - ((buffer + received) - fdata);
 
-        ssize_t remaining = atoi(fsize);
-        ssize_t to_write = (remaining < received) ? remaining : received;
-        if (fwrite(fdata, 1, to_write, file) < (size_t) to_write) {
-            fclose(file);
-            printf(ERROR_SEND_MSG);
+        int ret = authenticate_user(uid, pwd);
+        if (ret == ERR_USER_NOT_LOGGED_IN) {
+            reply_early(conn, "ROA NLG\n", 8, unread);
+            return;
+        } else if (ret != SUCCESS) {
+            reply_early(conn, "ROA NOK\n", 8, unread);
             return;
         }
 
-        if ((remaining -= to_write) > 0) {
-            remaining = read_file_data(fd, file, remaining);
-            fclose(file);
-            if (remaining > 0) {
-                write_all_bytes(fd, "ROA ERR\n", 4);
-                return;
-            }
-
-            if (remaining == -1) {
-                printf("An error occured while transferring data from socket to file.\n");
-                return;
-            }
-
-            received = read(fd, buffer, BUFSIZ_S);
-            if (received == -1) {
-                printf(ERROR_RECV_MSG);
-                remove(fname);
-                return;
-            }
-
-            fdata = buffer;
-        } else {
-            fclose(file);
-            fdata += to_write;
-            received -= to_write;
+        conn->aid = reserve_auction();
+        if (conn->aid == ERR_REACHED_AUCTION_MAX) {
+            conn->aid = 0;
+            reply_early(conn, "ROA NOK\n", 8, unread);
+            return;
+        } else if (conn->aid == ERROR) {
+            conn->aid = 0;
+            return;
         }
 
-        if (received != 1) {
-            write_all_bytes(fd, "ROA ERR\n", 4);
-            remove(fname);
+        // the asset goes straight to AUCTIONS/<aid>/ASSET
+        conn->upload_fd = create_asset_file(conn->aid, fname);
+        if (conn->upload_fd == -1) {
+            printf(ERROR_OPEN);
             return;
         }
 
-        if (*fdata != '\n') {
-            write_all_bytes(fd, "ROA ERR\n", 4);
-            remove(fname);
+        received = (buffer + received) - fdata;
+
+        conn->remaining = atoi(fsize);
+        ssize_t to_write = (conn->remaining < received) ? conn->remaining : received;
+        if (write_all_bytes(conn->upload_fd, fdata, to_write) == -1) {
+            perror("write");
             return;
         }
 
-        start_info_t auction;
-        strcpy(auction.uid, uid);
-        strcpy(auction.name, name);
-        strcpy(auction.value, start_value);
-        strcpy(auction.timeactive, timeactive);
-        strcpy(auction.fname, fname);
-        
-        int aid = create_auction(pwd, &auction);
+        conn->remaining -= to_write;
+        fdata += to_write;
+        received -= to_write;
 
-        if (aid > 0) {
-            int printed = sprintf(buffer, "ROA OK %03d\n", aid);
-            write_all_bytes(fd, buffer, printed);
-        } else if (aid == ERR_USER_NOT_LOGGED_IN) {
-            write_all_bytes(fd, "ROA NLG\n", 8);
-        } else {
-            write_all_bytes(fd, "ROA NOK\n", 8);
+        // the rest of the asset (and the end of line) is received by tcp_receive_asset()
+        if ((conn->remaining > 0) || (received == 0)) {
+            conn->state = CONN_ASSET;
+            return;
         }
+
+        tcp_command_open(conn, fdata, received);
     } else if (!strcmp(request, "CLS")) {
         char *uid = strsep(&ptr, delim);
         char *pwd = strsep(&ptr, delim);
         char *aid = strsep(&ptr, "\n");
-        print_verbose(uid, request, client_addr, client_addrlen);
+        print_verbose(uid, request, &conn->addr, conn->addrlen);
         
-        if ((*ptr != '\0') || !validate_user_id(uid) || !validate_user_password(pwd) ||
+        if (!ptr || (*ptr != '\0') || !validate_user_id(uid) || !validate_user_password(pwd) ||
                 !validate_auction_id(aid)) {
-            write_all_bytes(fd, "ERR\n", 4);
+            reply(conn, "ERR\n", 4);
             return;
         }
 
-        response_close(fd, uid, pwd, aid);
+        response_close(conn, uid, pwd, aid);
     } else if (!strcmp(request, "SAS")) {
         char *aid = strsep(&ptr, "\n");
-        print_verbose(NULL, request, client_addr, client_addrlen);
+        print_verbose(NULL, request, &conn->addr, conn->addrlen);
         
-        if ((*ptr != '\0') || !validate_auction_id(aid)) {
-            write_all_bytes(fd, "ERR\n", 4);
+        if (!ptr || (*ptr != '\0') || !validate_auction_id(aid)) {
+            reply(conn, "ERR\n", 4);
             return;
         }
 
-        response_show_asset(fd, aid);
+        response_show_asset(conn, aid);
     } else if (!strcmp(request, "BID")) {
         char *uid = strsep(&ptr, delim);
         char *pwd = strsep(&ptr, delim);
         char *aid = strsep(&ptr, delim);
         char *value = strsep(&ptr, "\n");
-        print_verbose(uid, request, client_addr, client_addrlen);
+        print_verbose(uid, request, &conn->addr, conn->addrlen);
         
-        if ((*ptr != '\0') || !validate_user_id(uid) || !validate_user_password(pwd) ||
+        if (!ptr || (*ptr != '\0') || !validate_user_id(uid) || !validate_user_password(pwd) ||
                 !validate_auction_id(aid) || !validate_auction_value(value)) {
-            write_all_bytes(fd, "ERR\n", 4);
+            reply(conn, "ERR\n", 4);
             return;
         }
 
-        response_bid(fd, uid, pwd, aid, value);
+        response_bid(conn, uid, pwd, aid, value);
     } else {
-        write_all_bytes(fd, "ERR\n", 4);
+        reply(conn, "ERR\n", 4);
     }
 }
 
-void udp_command_choser(int fd) {
-    struct sockaddr client_addr;
-    socklen_t client_addrlen = sizeof(client_addr);
+/* ---- TCP Connections ---- */
 
-    char buffer[BUFSIZ_S];
-    ssize_t received = recvfrom(fd, buffer, BUFSIZ_S, 0, &client_addr, &client_addrlen);
-    if (received == -1) {
-        perror("recvfrom");
-        return;
+/*
+ * The following handlers return -1 (with errno set to EAGAIN) when the socket would block,
+ * leaving the connection in a state from which they can be resumed later on.
+ */
+
+int tcp_receive_request(connection_t *conn) {
+    ssize_t res;
+    while (conn->received < BUFSIZ_L) {
+        res = read(conn->fd, conn->buffer + conn->received, BUFSIZ_L - conn->received);
+        if (res == 0) break;
+
+        if (res == -1) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return -1;
+            perror("read");
+            conn->state = CONN_CLOSED;
+            return 0;
+        }
+
+        conn->received += res;
+
+        // dispatch as soon as the request is complete, without waiting for the client to close
+        if (request_frame_length(conn->buffer, conn->received) > 0) break;
     }
 
-    if (connect(fd, &client_addr, client_addrlen) == -1) {
-        perror("connect");
-        return;
+    tcp_command_choser(conn);
+    if (conn->state == CONN_REQUEST) {
+        conn->state = CONN_CLOSED;
     }
 
-    if (!validate_protocol_message(buffer, received)) {
-        send(fd, "ERR\n", 4, 0);
-        return;
+    return 0;
+}
+
+int tcp_receive_asset(connection_t *conn) {
+    ssize_t res = 0;
+    while (conn->remaining > 0) {
+        res = splice_file_data(conn->fd, conn->upload_fd, conn->remaining);
+        if (res <= 0) break;
+        conn->remaining -= res;
     }
 
-    switch (fork()) {
-        case -1:
-            perror("fork");
-            return;
-        case 0:
+    // only the end of line is left
+    if (conn->remaining == 0) {
+        res = read(conn->fd, conn->buffer, BUFSIZ_S);
+        if (res > 0) {
+            tcp_command_open(conn, conn->buffer, res);
+            return 0;
+        }
+    }
+
+    if (res == -1) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return -1;
+        perror("read");
+        conn->state = CONN_CLOSED;
+        return 0;
+    }
+
+    // connection closed before the whole asset was received
+    close(conn->upload_fd);
+    conn->upload_fd = -1;
+    reply(conn, "ROA ERR\n", 8);
+    return 0;
+}
+
+int tcp_send_reply(connection_t *conn) {
+    ssize_t res;
+    while (conn->state == CONN_REPLY) {
+        if (conn->reply_sent < conn->reply_len) {
+            // hold the RSA header back so that it leaves in the same segments as the asset
+            int flags = (conn->asset_fd != -1) ? MSG_MORE : 0;
+            res = send(conn->fd, conn->reply + conn->reply_sent, conn->reply_len - conn->reply_sent, flags);
+            if (res > 0) conn->reply_sent += res;
+        } else if (conn->asset_fd == -1) {
+            conn->state = CONN_CLOSED;
+            if (conn->drain && (conn->remaining > 0)) {
+                // nothing else is sent, the client sees the end of the reply right away
+                shutdown(conn->fd, SHUT_WR);
+                conn->state = CONN_DRAIN;
+            }
+            return 0;
+        } else if (conn->asset_offset < conn->asset_size) {
+            res = send_file_data(conn->fd, conn->asset_fd, &conn->asset_offset,
+                conn->asset_size - conn->asset_offset);
+            if (res == 0) {
+                printf("Asset file is shorter than announced.\n");
+                conn->state = CONN_CLOSED;
+                return 0;
+            }
+        } else {
+            // asset fully sent, finish the message with an end of line
+            close(conn->asset_fd);
+            conn->asset_fd = -1;
+            reply(conn, "\n", 1);
+            continue;
+        }
+
+        if (res == -1) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return -1;
+            perror("write");
+            conn->state = CONN_CLOSED;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Closing a socket with unread data makes the kernel reset the connection, and the client may
+ * lose the reply it has not read yet. After an early reply the rest of the request is read and
+ * thrown away instead, until all of it arrived, the client closes or it stays idle for
+ * SOCKET_TIMEOUT_SECONDS.
+ */
+int tcp_drain(connection_t *conn) {
+    while (conn->remaining > 0) {
+        ssize_t len = (conn->remaining < BUFSIZ_L) ? conn->remaining : BUFSIZ_L;
+        ssize_t res = read(conn->fd, conn->buffer, len);
+        if (res > 0) {
+            conn->remaining -= res;
+            continue;
+        }
+
+        if ((res == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) return -1;
+        break;
+    }
+
+    conn->state = CONN_CLOSED;
+    return 0;
+}
+
+/*
+ * Moves on to the reply once it is durable. Forked children simply block, the epoll loop is
+ * woken through commit_fd() instead.
+ */
+int tcp_wait_commit(connection_t *conn) {
+    if (!use_epoll) {
+        commit_wait(conn->ticket);
+    }
+
+    if (!commit_done(conn->ticket)) {
+        return -1;
+    }
+
+    conn->state = CONN_REPLY;
+    return 0;
+}
+
+/* Runs the connection until it is closed or the socket would block. */
+int tcp_process(connection_t *conn) {
+    int ret = 0;
+    while ((ret == 0) && (conn->state != CONN_CLOSED)) {
+        switch (conn->state) {
+            case CONN_REQUEST:
+                ret = tcp_receive_request(conn);
+                break;
+            case CONN_ASSET:
+                ret = tcp_receive_asset(conn);
+                break;
+            case CONN_COMMIT:
+                ret = tcp_wait_commit(conn);
+                break;
+            case CONN_REPLY:
+                ret = tcp_send_reply(conn);
+                break;
+            case CONN_DRAIN:
+                ret = tcp_drain(conn);
+                break;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Called when the client stays idle for SOCKET_TIMEOUT_SECONDS. Incomplete requests are
+ * processed with whatever has been received so far (and usually rejected).
+ */
+void tcp_timeout(connection_t *conn) {
+    switch (conn->state) {
+        case CONN_REQUEST:
+            tcp_command_choser(conn);
+            if (conn->state == CONN_REQUEST) {
+                conn->state = CONN_CLOSED;
+            }
+            break;
+        case CONN_ASSET:
+            close(conn->upload_fd);
+            conn->upload_fd = -1;
+            reply(conn, "ROA ERR\n", 8);
+            break;
+        case CONN_COMMIT:
+            // the flush is on its way, the client is not the one being slow
             break;
         default:
-            return;
+            conn->state = CONN_CLOSED;
+            break;
     }
+}
+
+connection_t *connection_new(int fd, struct sockaddr *addr, socklen_t addrlen) {
+    connection_t *conn = calloc(1, sizeof(connection_t));
+    if (conn == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+
+    conn->fd = fd;
+    conn->state = CONN_REQUEST;
+    conn->addr = *addr;
+    conn->addrlen = addrlen;
+    conn->upload_fd = -1;
+    conn->asset_fd = -1;
+    return conn;
+}
+
+void connection_free(connection_t *conn) {
+    if (conn->upload_fd != -1) {
+        close(conn->upload_fd);
+    }
+
+    // the asset was not fully received, or the auction was never created
+    if (conn->aid > 0) {
+        cancel_auction(conn->aid);
+    }
+
+    if (conn->asset_fd != -1) {
+        close(conn->asset_fd);
+    }
+
+    close(conn->fd);
+    free(conn);
+}
+
+void udp_command_choser(datagram_t *dgram) {
+    char *buffer = dgram->buffer;
+    dgram->reply_data = dgram->reply;
+    dgram->reply_len = 0;
+
+    if ((dgram->received == 0) || !validate_protocol_message(buffer, dgram->received)) {
+        reply_datagram(dgram, "ERR\n", 4);
+        return;
+    }
+    buffer[dgram->received] = '\0';
     
     char *delim = " \n";
     char *label = strtok(buffer,delim);
     if (!label) {
-        send(fd, "ERR\n", 4, 0);
+        reply_datagram(dgram, "ERR\n", 4);
         return;
     }
     
     if (!strcmp(label, "LIN")) {
         char *uid = strtok(NULL, delim);
         char *pwd = strtok(NULL, delim);
-        print_verbose(uid, label, &client_addr, client_addrlen);
-        response_login(fd, uid, pwd);
+        print_verbose(uid, label, &dgram->addr, dgram->addrlen);
+        response_login(dgram, uid, pwd);
     } else if (!strcmp(label, "LOU")) {
         char *uid = strtok(NULL, delim);
         char *pwd = strtok(NULL, delim);
-        print_verbose(uid, label, &client_addr, client_addrlen);
-        response_logout(fd, uid, pwd);
+        print_verbose(uid, label, &dgram->addr, dgram->addrlen);
+        response_logout(dgram, uid, pwd);
     } else if (!strcmp(label, "UNR")) {
         char *uid = strtok(NULL, delim);
         char *pwd = strtok(NULL, delim);
-        print_verbose(uid, label, &client_addr, client_addrlen);
-        response_unregister(fd, uid, pwd);
+        print_verbose(uid, label, &dgram->addr, dgram->addrlen);
+        response_unregister(dgram, uid, pwd);
     } else if (!strcmp(label, "LMA")) {
         char *uid = strtok(NULL, delim);
-        print_verbose(uid, label, &client_addr, client_addrlen);
-        response_myauctions(fd, uid); 
+        print_verbose(uid, label, &dgram->addr, dgram->addrlen);
+        response_myauctions(dgram, uid); 
     } else if (!strcmp(label, "LMB")) {
         char *uid = strtok(NULL, delim);
-        print_verbose(uid, label, &client_addr, client_addrlen);
-        response_mybids(fd, uid);
+        print_verbose(uid, label, &dgram->addr, dgram->addrlen);
+        response_mybids(dgram, uid);
     } else if (!strcmp(label, "LST")) {
-        print_verbose(NULL, label, &client_addr, client_addrlen);
-        response_list(fd);
+        print_verbose(NULL, label, &dgram->addr, dgram->addrlen);
+        response_list(dgram);
     } else if (!strcmp(label, "SRC")) {
         char *aid = strtok(NULL, delim);
-        print_verbose(NULL, label, &client_addr, client_addrlen);
-        response_show_record(fd, aid);
+        char *offset = strtok(NULL, delim);
+        char *limit = strtok(NULL, delim);
+        print_verbose(NULL, label, &dgram->addr, dgram->addrlen);
+        response_show_record(dgram, aid, offset, limit);
     } else {
-        print_verbose(NULL, label, &client_addr, client_addrlen);
-        send(fd, "ERR\n", 4, 0);
+        print_verbose(NULL, label, &dgram->addr, dgram->addrlen);
+        reply_datagram(dgram, "ERR\n", 4);
     }
+}
 
-    client_addr.sa_family = AF_UNSPEC;
-    if (connect(fd, &client_addr, client_addrlen) == -1) {
-        perror("connect");
-        return;
+int udp_socket(struct sockaddr *server_addr, socklen_t server_addrlen) {
+    int serverfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (serverfd == -1) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    int enable = 1;
+    if (setsockopt(serverfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) == -1) {
+        perror("setsockopt(SO_REUSEADDR)");
+        exit(EXIT_FAILURE);
     }
+
+    // every worker binds its own socket to the same port, the kernel balances between them
+    if (setsockopt(serverfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) == -1) {
+        perror("setsockopt(SO_REUSEPORT)");
+        exit(EXIT_FAILURE);
+    }
+
+    if (bind(serverfd, server_addr, server_addrlen) == -1) {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+
+    return serverfd;
 }
 
-void udp_listener(struct sockaddr *server_addr, socklen_t server_addrlen) {
-    int serverfd;
+/* Sends all replies of a batch, skipping the ones that could not be sent. */
+void udp_send_batch(int serverfd, struct mmsghdr *msgs, int count) {
+    int sent = 0;
+    while (sent < count) {
+        int res = sendmmsg(serverfd, msgs + sent, count - sent, 0);
+        if (res == -1) {
+            if (errno == EINTR) continue;
+            perror("sendmmsg");
+            sent++;
+        } else {
+            sent += res;
+        }
+    }
+}
 
-    while ((serverfd = socket(AF_INET, SOCK_DGRAM, 0)) != -1) {
+/* Drains requests in batches of up to UDP_BATCH_SIZE datagrams per system call. */
+void udp_worker(struct sockaddr *server_addr, socklen_t server_addrlen) {
+    int serverfd = udp_socket(server_addr, server_addrlen);
+
+    static datagram_t batch[UDP_BATCH_SIZE];
+    struct mmsghdr requests[UDP_BATCH_SIZE];
+    struct mmsghdr replies[UDP_BATCH_SIZE];
+    struct iovec request_iov[UDP_BATCH_SIZE];
+    struct iovec reply_iov[UDP_BATCH_SIZE];
+
+    while (1) {
+        for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+            request_iov[i].iov_base = batch[i].buffer;
+            request_iov[i].iov_len = BUFSIZ_S;
+
+            memset(&requests[i], 0, sizeof(struct mmsghdr));
+            requests[i].msg_hdr.msg_name = &batch[i].addr;
+            requests[i].msg_hdr.msg_namelen = sizeof(batch[i].addr);
+            requests[i].msg_hdr.msg_iov = &request_iov[i];
+            requests[i].msg_hdr.msg_iovlen = 1;
+        }
 
-        if (setsockopt(serverfd, SOL_SOCKET, SO_REUSEADDR, &serverfd, sizeof(int)) == -1) {
-            perror("setsockopt(SO_REUSEADDR)");
-            exit(EXIT_FAILURE);
+        int n = recvmmsg(serverfd, requests, UDP_BATCH_SIZE, MSG_WAITFORONE, NULL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("recvmmsg");
+            break;
         }
 
-        if (bind(serverfd, server_addr, server_addrlen) == -1) {
-            perror("bind");
-            exit(EXIT_FAILURE);
+        reply_cache_next_batch();
+
+        int count = 0;
+        for (int i = 0; i < n; i++) {
+            datagram_t *dgram = &batch[i];
+            dgram->received = requests[i].msg_len;
+            dgram->addrlen = requests[i].msg_hdr.msg_namelen;
+
+            udp_command_choser(dgram);
+            if (dgram->reply_len == 0) continue;
+
+            reply_iov[count].iov_base = dgram->reply_data;
+            reply_iov[count].iov_len = dgram->reply_len;
+
+            memset(&replies[count], 0, sizeof(struct mmsghdr));
+            replies[count].msg_hdr.msg_name = &dgram->addr;
+            replies[count].msg_hdr.msg_namelen = dgram->addrlen;
+            replies[count].msg_hdr.msg_iov = &reply_iov[count];
+            replies[count].msg_hdr.msg_iovlen = 1;
+            count++;
         }
 
-        udp_command_choser(serverfd);
+        udp_send_batch(serverfd, replies, count);
     }
 
-    perror("socket");
     close(serverfd);
 }
 
-void tcp_listener(struct sockaddr *server_addr, socklen_t server_addrlen) {
+/* Starts udp_workers processes, the current one being the last of them. */
+void udp_listener(struct sockaddr *server_addr, socklen_t server_addrlen) {
+    for (int i = 1; i < udp_workers; i++) {
+        switch (fork()) {
+            case -1:
+                perror("fork");
+                exit(EXIT_FAILURE);
+            case 0:
+                udp_worker(server_addr, server_addrlen);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    udp_worker(server_addr, server_addrlen);
+}
+
+int tcp_socket(struct sockaddr *server_addr, socklen_t server_addrlen) {
     int serverfd = socket(AF_INET, SOCK_STREAM, 0);
     if (serverfd == -1) {
         perror("socket");
@@ -746,6 +1184,11 @@ void tcp_listener(struct sockaddr *server_addr, socklen_t server_addrlen) {
         exit(EXIT_FAILURE);
     }
 
+    return serverfd;
+}
+
+/* Forks a new process for every connection (-m fork). */
+void tcp_fork_listener(int serverfd) {
     struct timeval timeout = { .tv_sec = SOCKET_TIMEOUT_SECONDS, .tv_usec = 0 };
 
     struct sockaddr client_addr;
@@ -768,19 +1211,239 @@ void tcp_listener(struct sockaddr *server_addr, socklen_t server_addrlen) {
             case -1:
                 perror("fork");
                 exit(EXIT_FAILURE);
-            case 0:
-                tcp_command_choser(clientfd, &client_addr, client_addrlen);
-                close(clientfd);
+            case 0: {
+                connection_t *conn = connection_new(clientfd, &client_addr, client_addrlen);
+                if (conn == NULL) exit(EXIT_FAILURE);
+
+                // on a blocking socket, EAGAIN means that SO_RCVTIMEO/SO_SNDTIMEO expired
+                while (conn->state != CONN_CLOSED) {
+                    if (tcp_process(conn) == -1) {
+                        tcp_timeout(conn);
+                    }
+                }
+
+                connection_free(conn);
                 exit(EXIT_SUCCESS);
+            }
         }
 
         close(clientfd);
+        client_addrlen = sizeof(client_addr);
     }
 
     perror("accept");
     close(serverfd);
 }
 
+long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Since every connection has the same idle timeout, refreshing a deadline is just moving the
+ * connection to the tail of the idle list. Tickets are taken in order by this single process,
+ * so connections waiting on a flush are completed from the head of the committing list.
+ */
+connection_list_t committing = { NULL, NULL };
+
+void connection_list_remove(connection_list_t *list, connection_t *conn) {
+    if (conn->list != list) return; // not in the list
+
+    if (conn->prev) conn->prev->next = conn->next;
+    else list->head = conn->next;
+
+    if (conn->next) conn->next->prev = conn->prev;
+    else list->tail = conn->prev;
+
+    conn->prev = conn->next = NULL;
+    conn->list = NULL;
+}
+
+void connection_list_append(connection_list_t *list, connection_t *conn) {
+    conn->list = list;
+    conn->prev = list->tail;
+    conn->next = NULL;
+
+    if (list->tail) list->tail->next = conn;
+    else list->head = conn;
+
+    list->tail = conn;
+}
+
+/* Updates the epoll interest of a connection after it made progress, or frees it once closed. */
+void tcp_epoll_update(int epollfd, connection_list_t *list, connection_t *conn) {
+    if (conn->list) {
+        connection_list_remove(conn->list, conn);
+    }
+
+    if (conn->state == CONN_CLOSED) {
+        // closing the descriptor also removes it from the epoll set
+        connection_free(conn);
+        return;
+    }
+
+    // hangups are reported even without interest, so connections waiting on a flush leave the set
+    uint32_t events = EPOLLIN;
+    if (conn->state == CONN_REPLY) events = EPOLLOUT;
+    else if (conn->state == CONN_COMMIT) events = 0;
+
+    if (events != conn->events) {
+        struct epoll_event event = { .events = events, .data.ptr = conn };
+        int op = (events == 0) ? EPOLL_CTL_DEL : ((conn->events == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+        if (epoll_ctl(epollfd, op, conn->fd, &event) == -1) {
+            perror("epoll_ctl");
+            connection_free(conn);
+            return;
+        }
+        conn->events = events;
+    }
+
+    if (conn->state == CONN_COMMIT) {
+        connection_list_append(&committing, conn);
+        return;
+    }
+
+    conn->deadline = monotonic_ms() + SOCKET_TIMEOUT_SECONDS * 1000;
+    connection_list_append(list, conn);
+}
+
+void tcp_epoll_accept(int epollfd, int serverfd, connection_list_t *list) {
+    struct sockaddr client_addr;
+    socklen_t client_addrlen = sizeof(client_addr);
+
+    int clientfd;
+
+    while ((clientfd = accept4(serverfd, &client_addr, &client_addrlen, SOCK_NONBLOCK)) != -1) {
+        connection_t *conn = connection_new(clientfd, &client_addr, client_addrlen);
+        client_addrlen = sizeof(client_addr);
+        if (conn == NULL) {
+            close(clientfd);
+            continue;
+        }
+
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, clientfd, &event) == -1) {
+            perror("epoll_ctl");
+            connection_free(conn);
+            continue;
+        }
+        conn->events = EPOLLIN;
+
+        // most requests are already in the socket buffer by now
+        tcp_process(conn);
+        tcp_epoll_update(epollfd, list, conn);
+    }
+
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        perror("accept");
+    }
+}
+
+/* Sends the replies whose mutations were just flushed. */
+void tcp_epoll_commit(int epollfd, connection_list_t *list) {
+    uint64_t flushes;
+    if (read(commit_fd(), &flushes, sizeof(flushes)) == -1) {
+        if (errno != EAGAIN) perror("read");
+    }
+
+    while (committing.head && commit_done(committing.head->ticket)) {
+        connection_t *conn = committing.head;
+        tcp_process(conn);
+        tcp_epoll_update(epollfd, list, conn);
+    }
+}
+
+/* Serves every connection from a single process, driven by epoll (-m epoll). */
+void tcp_epoll_listener(int serverfd) {
+    int epollfd = epoll_create1(0);
+    if (epollfd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fcntl(serverfd, F_SETFL, fcntl(serverfd, F_GETFL) | O_NONBLOCK) == -1) {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, serverfd, &event) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+
+    event.data.ptr = &committing;
+    if (commit_enabled() && (epoll_ctl(epollfd, EPOLL_CTL_ADD, commit_fd(), &event) == -1)) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+
+    connection_list_t list = { NULL, NULL };
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    while (1) {
+        int timeout = -1;
+        if (list.head) {
+            timeout = list.head->deadline - monotonic_ms();
+            if (timeout < 0) timeout = 0;
+        }
+
+        int n = epoll_wait(epollfd, events, EPOLL_MAX_EVENTS, timeout);
+        if ((n == -1) && (errno != EINTR)) {
+            perror("epoll_wait");
+            break;
+        }
+
+        int flushed = 0;
+        for (int i = 0; i < n; i++) {
+            connection_t *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                tcp_epoll_accept(epollfd, serverfd, &list);
+                continue;
+            }
+
+            if ((void *) conn == &committing) {
+                flushed = 1;
+                continue;
+            }
+
+            // reported in this batch before it was removed from the set
+            if (conn->state == CONN_COMMIT) continue;
+
+            tcp_process(conn);
+            tcp_epoll_update(epollfd, &list, conn);
+        }
+
+        // after the batch, since completed connections may be freed
+        if (flushed) {
+            tcp_epoll_commit(epollfd, &list);
+        }
+
+        long now = monotonic_ms();
+        while (list.head && (list.head->deadline <= now)) {
+            connection_t *conn = list.head;
+            tcp_timeout(conn);
+            tcp_process(conn);
+            tcp_epoll_update(epollfd, &list, conn);
+        }
+    }
+
+    close(epollfd);
+    close(serverfd);
+}
+
+void tcp_listener(struct sockaddr *server_addr, socklen_t server_addrlen) {
+    int serverfd = tcp_socket(server_addr, server_addrlen);
+
+    if (use_epoll) {
+        tcp_epoll_listener(serverfd);
+    } else {
+        tcp_fork_listener(serverfd);
+    }
+}
+
 /* ---- Initialization ---- */
 
 void handle_signals() {
@@ -794,10 +1457,22 @@ void handle_signals() {
         printf(ERROR_SIGACTION);
         exit(EXIT_FAILURE);
     }
+
+    // a client closing its socket early must not bring down the whole listener
+    if (sigaction(SIGPIPE, &act, NULL) == -1) {
+        printf(ERROR_SIGACTION);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void usage() {
+    printf("Usage: ./server [-p server_port] [-v] [-w udp_workers] [-m epoll|fork] [-s dir|memory|file] [-b files|log] [-d commit_window_us] [-c commit_records]\n");
+    exit(EXIT_FAILURE);
 }
 
 int main(int argc, char **argv) {
     struct sockaddr_in server_addr_in;
+    int bids = BIDS_FILES;
 
     server_addr_in.sin_family = AF_INET;
     server_addr_in.sin_addr.s_addr = INADDR_ANY;
@@ -808,21 +1483,73 @@ int main(int argc, char **argv) {
             verbose = 1;
         } else if (!strcmp(argv[i], PORT_FLAG)) {
             server_addr_in.sin_port = htons(atoi(argv[++i]));
+        } else if (!strcmp(argv[i], WORKERS_FLAG) && (i+1 < argc) && (atoi(argv[i+1]) > 0)) {
+            udp_workers = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], MODE_FLAG) && (i+1 < argc) && !strcmp(argv[i+1], MODE_EPOLL)) {
+            use_epoll = 1;
+            i++;
+        } else if (!strcmp(argv[i], MODE_FLAG) && (i+1 < argc) && !strcmp(argv[i+1], MODE_FORK)) {
+            use_epoll = 0;
+            i++;
+        } else if (!strcmp(argv[i], COMMIT_WINDOW_FLAG) && (i+1 < argc) && (atol(argv[i+1]) >= 0) &&
+                isdigit(argv[i+1][0])) {
+            commit_window_us = atol(argv[++i]);
+        } else if (!strcmp(argv[i], COMMIT_RECORDS_FLAG) && (i+1 < argc) && (atoi(argv[i+1]) > 0)) {
+            commit_records = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], STORAGE_FLAG) && (i+1 < argc) && (set_storage_backend(argv[i+1]) == SUCCESS)) {
+            i++;
+        } else if (!strcmp(argv[i], BIDS_FLAG) && (i+1 < argc) && !strcmp(argv[i+1], BIDS_FILES_NAME)) {
+            bids = BIDS_FILES;
+            i++;
+        } else if (!strcmp(argv[i], BIDS_FLAG) && (i+1 < argc) && !strcmp(argv[i+1], BIDS_LOG_NAME)) {
+            bids = BIDS_LOG;
+            i++;
         } else {
-            printf("Usage: ./server [-p server_port] [-v]\n");
-            exit(EXIT_FAILURE);
+            usage();
         }
     }
 
-    if ((mkdir("AUCTIONS", S_IRWXU) == -1) && (errno != EEXIST)) {
+    // the other backends keep bids in their own records
+    if ((bids == BIDS_LOG) && strcmp(storage_name(), dir_backend.name)) {
+        printf("-b log is only supported by the dir backend.\n");
+        usage();
+    }
+    set_bid_storage(bids);
+
+    // shared by all listeners, so it must exist before they are forked
+    if ((init_storage() == ERROR) || (index_init(storage_users_table(), storage_generation()) == -1) || (bidbook_init() == -1) ||
+            (load_auctions() == ERROR) || (scheduler_init() == -1)) {
         exit(EXIT_FAILURE);
     }
 
-    if ((mkdir("USERS", S_IRWXU) == -1) && (errno != EEXIST)) {
+    // durable mode, replies to mutations wait for a flush
+    if ((commit_window_us >= 0) && (commit_init(commit_window_us, commit_records) == -1)) {
         exit(EXIT_FAILURE);
     }
 
     handle_signals();
+    switch (fork()) {
+        case -1:
+            perror("fork");
+            exit(EXIT_FAILURE);
+        case 0:
+            // child process
+            scheduler_run();
+            break;
+    }
+
+    if (commit_enabled()) {
+        switch (fork()) {
+            case -1:
+                perror("fork");
+                exit(EXIT_FAILURE);
+            case 0:
+                // child process
+                commit_run();
+                break;
+        }
+    }
+
     switch (fork()) {
         case -1:
             perror("fork");
@@ -0,0 +1,70 @@
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "bidlog.h"
+#include "database.h"
+
+/*
+ * Operations every storage backend implements. database.c answers the protocol on top of
+ * them and of the in-memory auction index, so backends only persist and retrieve records.
+ * Unless stated otherwise, they return SUCCESS, NOT_FOUND or ERROR.
+ */
+typedef struct {
+	char *name;
+	int (*init)();
+	int (*sync)();
+
+	/* File the users table is mapped from, NULL if the backend does not outlive the server */
+	char *users_table;
+
+	/* Identifies the records held, renewed whenever they are created from scratch */
+	uint64_t (*generation)();
+
+	/* Users */
+	int (*is_registered)(char *uid);
+	int (*is_logged_in)(char *uid);
+	int (*register_user)(char *uid, char *pwd);
+	int (*unregister_user)(char *uid);
+	int (*get_password)(char *uid, char *pwd);
+	int (*set_login)(char *uid);
+	int (*erase_login)(char *uid);
+
+	/* Auctions */
+	int (*reserve_auction)(int aid);
+	int (*cancel_auction)(int aid);
+	int (*write_start)(int aid, start_info_t *auction, time_t start);
+	int (*read_start)(int aid, start_info_t *start_info);
+	int (*write_end)(int aid, time_t end, long elapsed);
+	int (*read_end)(int aid, end_info_t *end_info);
+	int (*add_hosted)(char *uid, int aid);
+	int (*load_auctions)();
+
+	/* Bids */
+	int (*add_bid)(int aid, bid_record_t *record);
+	int (*add_bidded)(char *uid, int aid);
+	int (*read_bids)(int aid, bid_info_t *bids, int offset, int max);
+	int (*read_bidded)(char *uid, char *bidded);
+
+	/* Assets */
+	int (*create_asset)(int aid, char *fname);
+	int (*open_asset)(int aid, char *fname, off_t *fsize);
+} storage_backend_t;
+
+/* Directory tree under USERS/ and AUCTIONS/. */
+extern storage_backend_t dir_backend;
+
+/* Fixed-size records in a shared anonymous mapping, lost on restart. */
+extern storage_backend_t memory_backend;
+
+/* The same records mapped from a single file. */
+extern storage_backend_t file_backend;
+
+void set_bid_storage(int storage);
+
+uint64_t new_generation();
+
+#endif
@@ -0,0 +1,894 @@
+#define _GNU_SOURCE // syncfs()
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+/* Files */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include "storage.h"
+#include "bidlog.h"
+#include "fsdir.h"
+#include "index.h"
+
+/* Auction Protocol */
+#include "auction.h"
+
+/* Misc */
+#include "utils.h"
+
+/*
+ * Backend keeping every record in its own file:
+ *   USERS/{users.db, GENERATION.dat}
+ *   USERS/<uid>/{<uid>_pass.txt, <uid>_login.txt, HOSTED/, BIDDED/}
+ *   AUCTIONS/<aid>/{START_<aid>.dat, END_<aid>.dat, ASSET/, BIDS/}
+ * Start, end and bid files hold a single fixed-size binary record behind a versioned header.
+ * Bids are either one file per bid or an append-only log, see bidlog.c.
+ * Records are opened relative to their user or auction directory, see fsdir.c.
+ */
+
+// where bids are kept, chosen once at startup
+int bid_storage = BIDS_FILES;
+
+void set_bid_storage(int storage) {
+    bid_storage = storage;
+}
+
+/* ---- Utils ---- */
+
+int file_exists(int dirfd, char *name) {
+    struct stat statbuf;
+
+    if (dirfd == -1) {
+        return (errno == ENOENT) ? NOT_FOUND : ERROR;
+    }
+
+    if (fstatat(dirfd, name, &statbuf, 0) == 0) {
+        return SUCCESS;
+    }
+
+    if (errno != ENOENT) {
+        perror("fstatat");
+        return ERROR;
+    }
+
+    return NOT_FOUND;
+}
+
+FILE *fopen_at(int dirfd, char *name, int flags, char *mode) {
+    int fd = (dirfd == -1) ? -1 : openat(dirfd, name, flags | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    FILE *file = fdopen(fd, mode);
+    if (file == NULL) {
+        close(fd);
+    }
+
+    return file;
+}
+
+int mkdir_at(int dirfd, char *name) {
+    if ((mkdirat(dirfd, name, S_IRWXU) == -1) && (errno != EEXIST)) {
+        perror("mkdirat");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/* ---- Records ---- */
+
+#define RECORD_MAGIC 0x52454344 // "RECD"
+#define RECORD_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+} record_header_t;
+
+// the header and the record go out in a single write
+int write_record(int dirfd, char *name, void *record, size_t size) {
+    record_header_t header = { RECORD_MAGIC, RECORD_VERSION };
+    struct iovec iov[2] = { { &header, sizeof(header) }, { record, size } };
+
+    int fd = (dirfd == -1) ? -1 :
+        openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return ERROR;
+    }
+
+    ssize_t n = writev(fd, iov, 2);
+    close(fd);
+
+    return (n == (ssize_t) (sizeof(header) + size)) ? SUCCESS : ERROR;
+}
+
+/**
+ * Reads a record written by write_record() with a single pread.
+ * Returns:
+ * - ERROR if a general error occurred, or the record is short or of another version.
+ * - NOT_FOUND if the file does not exist.
+ * - SUCCESS otherwise.
+*/
+int read_record(int dirfd, char *name, void *record, size_t size) {
+    record_header_t header;
+    struct iovec iov[2] = { { &header, sizeof(header) }, { record, size } };
+
+    int fd = (dirfd == -1) ? -1 : openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return (errno == ENOENT) ? NOT_FOUND : ERROR;
+    }
+
+    ssize_t n = preadv(fd, iov, 2, 0);
+    close(fd);
+
+    if ((n != (ssize_t) (sizeof(header) + size)) || (header.magic != RECORD_MAGIC) ||
+            (header.version != RECORD_VERSION)) {
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+// VVVVVV.dat, other files in BIDS/ are ignored
+int is_bid_file(char *name) {
+    return (strlen(name) == AUCTION_VALUE_MAX_LEN + 4) && !strcmp(name + AUCTION_VALUE_MAX_LEN, ".dat");
+}
+
+#define DIR_USERS_TABLE "USERS/users.db"
+#define DIR_GENERATION "GENERATION.dat" // in USERS/
+
+// working directory, where every record lives
+static int dir_fd = -1;
+static uint64_t generation = 0;
+
+int dir_init() {
+    char *trees[] = { "AUCTIONS", "USERS" };
+    int created = 0;
+
+    if ((dir_fd = open(".", O_RDONLY | O_DIRECTORY)) == -1) {
+        perror("open");
+        return ERROR;
+    }
+
+    for (size_t i = 0; i < sizeof(trees) / sizeof(trees[0]); i++) {
+        if (mkdirat(dir_fd, trees[i], S_IRWXU) == 0) {
+            created = 1;
+        } else if (errno != EEXIST) {
+            perror("mkdirat");
+            return ERROR;
+        }
+    }
+
+    if (fsdir_init(dir_fd) == -1) {
+        return ERROR;
+    }
+
+    // a tree created anew invalidates whatever was derived from the previous one
+    if (created || (read_record(fsdir_users(), DIR_GENERATION, &generation, sizeof(generation)) != SUCCESS)) {
+        generation = new_generation();
+        if (write_record(fsdir_users(), DIR_GENERATION, &generation, sizeof(generation)) == ERROR) {
+            perror("write");
+            return ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
+
+uint64_t dir_generation() {
+    return generation;
+}
+
+// records are spread over many files, flushing the whole file system is a single call
+int dir_sync() {
+    if (syncfs(dir_fd) == -1) {
+        perror("syncfs");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/* ---- Users ---- */
+
+int dir_is_registered(char *uid) {
+    char name[BUFSIZ_S];
+    sprintf(name, "%s_pass.txt", uid);
+    return file_exists(fsdir_user(uid), name);
+}
+
+int dir_is_logged_in(char *uid) {
+    char name[BUFSIZ_S];
+    sprintf(name, "%s_login.txt", uid);
+    return file_exists(fsdir_user(uid), name);
+}
+
+int create_user_dirs(char *uid) {
+    if (mkdir_at(fsdir_users(), uid) == ERROR) {
+        return ERROR;
+    }
+
+    int user_fd = fsdir_user(uid);
+    if (user_fd == -1) {
+        perror("openat");
+        return ERROR;
+    }
+
+    if ((mkdir_at(user_fd, "HOSTED") == ERROR) || (mkdir_at(user_fd, "BIDDED") == ERROR)) {
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int dir_register_user(char *uid, char *pwd) {
+    char name[BUFSIZ_S];
+
+    if (create_user_dirs(uid) == ERROR) {
+        return ERROR;
+    }
+
+    sprintf(name, "%s_pass.txt", uid);
+    int fd = openat(fsdir_user(uid), name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        perror("openat");
+        return ERROR;
+    }
+
+    ssize_t n = write(fd, pwd, USER_PWD_LEN);
+    close(fd);
+
+    if (n < USER_PWD_LEN) {
+        perror("write");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int dir_unregister_user(char *uid) {
+    char name[BUFSIZ_S];
+    int user_fd = fsdir_user(uid);
+
+    if (user_fd != -1) {
+        sprintf(name, "%s_pass.txt", uid);
+        unlinkat(user_fd, name, 0);
+    }
+    return SUCCESS;
+}
+
+int dir_get_password(char *uid, char *pwd) {
+    char name[BUFSIZ_S];
+    int user_fd = fsdir_user(uid);
+    int fd = -1;
+
+    if (user_fd != -1) {
+        sprintf(name, "%s_pass.txt", uid);
+        fd = openat(user_fd, name, O_RDONLY | O_CLOEXEC);
+    }
+
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("openat");
+            return ERROR;
+        }
+
+        return ERR_USER_NOT_REGISTERED;
+    }
+
+    ssize_t n = read(fd, pwd, USER_PWD_LEN);
+    close(fd);
+
+    if (n != USER_PWD_LEN) {
+        perror("read");
+        return ERROR;
+    }
+
+    pwd[USER_PWD_LEN] = '\0';
+    return SUCCESS;
+}
+
+int dir_set_login(char *uid) {
+    char name[BUFSIZ_S];
+    sprintf(name, "%s_login.txt", uid);
+
+    int fd = openat(fsdir_user(uid), name, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        perror("openat");
+        return ERROR;
+    }
+
+    close(fd);
+    return SUCCESS;
+}
+
+int dir_erase_login(char *uid) {
+    char name[BUFSIZ_S];
+    int user_fd = fsdir_user(uid);
+
+    if (user_fd != -1) {
+        sprintf(name, "%s_login.txt", uid);
+        unlinkat(user_fd, name, 0);
+    }
+    return SUCCESS;
+}
+
+/* ---- Auctions ---- */
+
+int create_auction_dirs(int aid) {
+    int auction_fd = fsdir_auction(aid);
+    if (auction_fd == -1) {
+        perror("openat");
+        return ERROR;
+    }
+
+    if ((mkdir_at(auction_fd, "ASSET") == ERROR) || (mkdir_at(auction_fd, "BIDS") == ERROR)) {
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int dir_cancel_auction(int aid) {
+    char name[AUCTION_ID_BUFSIZ];
+    sprintf(name, "%03d", aid);
+
+    fsdir_forget_auction(aid);
+    fsdir_erase(fsdir_auctions(), name);
+    return SUCCESS;
+}
+
+// mkdirat() fails if a concurrent request reserved the same ID first
+int dir_reserve_auction(int aid) {
+    char name[AUCTION_ID_BUFSIZ];
+    sprintf(name, "%03d", aid);
+
+    if (mkdirat(fsdir_auctions(), name, S_IRWXU) == -1) {
+        if (errno == EEXIST) {
+            return ERR_AUCTION_EXISTS;
+        }
+
+        perror("mkdirat");
+        return ERROR;
+    }
+
+    if (create_auction_dirs(aid) == ERROR) {
+        dir_cancel_auction(aid);
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int dir_write_start(int aid, start_info_t *auction, time_t rawtime) {
+    char name[BUFSIZ_S];
+    start_record_t record = { 0 };
+
+    strcpy(record.uid, auction->uid);
+    strcpy(record.name, auction->name);
+    strcpy(record.fname, auction->fname);
+    record.value = atol(auction->value);
+    record.timeactive = atol(auction->timeactive);
+    record.start = rawtime;
+
+    sprintf(name, "START_%03d.dat", aid);
+    if (write_record(fsdir_auction(aid), name, &record, sizeof(record)) == ERROR) {
+        perror("write");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int dir_read_start(int aid, start_info_t *start_info) {
+    char name[BUFSIZ_S];
+    start_record_t record;
+
+    sprintf(name, "START_%03d.dat", aid);
+    if (read_record(fsdir_auction(aid), name, &record, sizeof(record)) != SUCCESS) {
+        return ERROR;
+    }
+
+    time_t start = record.start;
+    struct tm *timeinfo = localtime(&start);
+
+    strcpy(start_info->uid, record.uid);
+    strcpy(start_info->name, record.name);
+    strcpy(start_info->fname, record.fname);
+    sprintf(start_info->value, "%u", record.value);
+    sprintf(start_info->timeactive, "%u", record.timeactive);
+    strftime(start_info->date, sizeof(start_info->date), "%Y-%m-%d", timeinfo);
+    strftime(start_info->time, sizeof(start_info->time), "%H:%M:%S", timeinfo);
+    return SUCCESS;
+}
+
+int dir_write_end(int aid, time_t end_fulltime, long elapsed) {
+    char name[BUFSIZ_S];
+    end_record_t record = { 0 };
+
+    record.end = end_fulltime;
+    record.elapsed = elapsed;
+
+    sprintf(name, "END_%03d.dat", aid);
+    return write_record(fsdir_auction(aid), name, &record, sizeof(record));
+}
+
+int dir_read_end(int aid, end_info_t *end_info) {
+    char name[BUFSIZ_S];
+    end_record_t record;
+
+    sprintf(name, "END_%03d.dat", aid);
+    int ret = read_record(fsdir_auction(aid), name, &record, sizeof(record));
+    if (ret != SUCCESS) {
+        return ret;
+    }
+
+    time_t end = record.end;
+    struct tm *timeinfo = localtime(&end);
+
+    strftime(end_info->date, sizeof(end_info->date), "%Y-%m-%d", timeinfo);
+    strftime(end_info->time, sizeof(end_info->time), "%H:%M:%S", timeinfo);
+    sprintf(end_info->sec_time, "%u", record.elapsed);
+    return SUCCESS;
+}
+
+// creates an empty marker file, used for the HOSTED/ and BIDDED/ entries
+int touch_at(int dirfd, char *name) {
+    int fd = (dirfd == -1) ? -1 : openat(dirfd, name, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return ERROR;
+    }
+
+    close(fd);
+    return SUCCESS;
+}
+
+int dir_add_hosted(char *uid, int aid) {
+    char name[BUFSIZ_S];
+    sprintf(name, "HOSTED/%03d.txt", aid);
+
+    if (touch_at(fsdir_user(uid), name) == ERROR) {
+        perror("openat");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+// highest bid placed in a given auction, or its start value if there is none
+long read_max_bid_value(int aid, long start_value) {
+    struct dirent **filelist;
+    int n_entries;
+    long max_bid = start_value;
+
+    if (bid_storage == BIDS_LOG) {
+        bid_record_t record;
+        return (bidlog_max_bid(aid, &record) == SUCCESS) ? (long) record.value : start_value;
+    }
+
+    int auction_fd = fsdir_auction(aid);
+    if (auction_fd == -1)
+        return start_value;
+
+    n_entries = scandirat(auction_fd, "BIDS", &filelist, 0, alphasort);
+    if (n_entries <= 0)
+        return start_value;
+
+    // file names are order ascendently,
+    // so start from end to get max bid value
+    for (int iter = n_entries - 1; iter >= 0; iter--) {
+        if (is_bid_file(filelist[iter]->d_name) && (max_bid == start_value)) {
+            max_bid = atol(filelist[iter]->d_name);
+        }
+        free(filelist[iter]);
+    }
+    free(filelist);
+
+    return max_bid;
+}
+
+/* ---- Conversion ---- */
+
+/*
+ * Trees written before records were binary keep them as whitespace-separated text files
+ * (START_<aid>.txt, END_<aid>.txt and BIDS/VVVVVV.txt). They are converted while the auctions
+ * are loaded: every record is rewritten in binary before its text file is removed, and the
+ * start record goes last, so an interrupted conversion is simply resumed on the next start.
+ */
+
+// uid value date time elapsed
+int convert_text_bids(int auction_fd, time_t start) {
+    char name[BUFSIZ_S];
+    bid_record_t record;
+    long value, elapsed;
+    FILE *fp;
+
+    int bids_fd = openat(auction_fd, "BIDS", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (bids_fd == -1) {
+        return (errno == ENOENT) ? SUCCESS : ERROR;
+    }
+
+    DIR *d = fdopendir(bids_fd);
+    if (d == NULL) {
+        close(bids_fd);
+        return ERROR;
+    }
+
+    struct dirent *p;
+    int ret = SUCCESS;
+    while ((ret == SUCCESS) && (p = readdir(d))) {
+        if ((strlen(p->d_name) != AUCTION_VALUE_MAX_LEN + 4) ||
+                strcmp(p->d_name + AUCTION_VALUE_MAX_LEN, ".txt")) {
+            continue;
+        }
+
+        if ((fp = fopen_at(bids_fd, p->d_name, O_RDONLY, "r")) == NULL) {
+            ret = ERROR;
+            break;
+        }
+
+        memset(&record, 0, sizeof(record));
+        int n = fscanf(fp, "%6s %ld %*s %*s %ld", record.uid, &value, &elapsed);
+        fclose(fp);
+        if (n != 3) {
+            ret = ERROR;
+            break;
+        }
+
+        record.value = value;
+        record.elapsed = elapsed;
+        record.time = start + elapsed;
+
+        sprintf(name, "%06u.dat", record.value);
+        if ((write_record(bids_fd, name, &record, sizeof(record)) == ERROR) ||
+                (unlinkat(bids_fd, p->d_name, 0) == -1)) {
+            ret = ERROR;
+        }
+    }
+    closedir(d);
+
+    return ret;
+}
+
+// date time elapsed, the end is always start + elapsed
+int convert_text_end(int auction_fd, int aid, time_t start) {
+    char name[BUFSIZ_S];
+    end_record_t record = { 0 };
+    long elapsed;
+
+    sprintf(name, "END_%03d.txt", aid);
+    FILE *fp = fopen_at(auction_fd, name, O_RDONLY, "r");
+    if (fp == NULL) {
+        return (errno == ENOENT) ? SUCCESS : ERROR;
+    }
+
+    int n = fscanf(fp, "%*s %*s %ld", &elapsed);
+    fclose(fp);
+    if (n != 1) {
+        return ERROR;
+    }
+
+    record.end = start + elapsed;
+    record.elapsed = elapsed;
+
+    char text_name[BUFSIZ_S];
+    strcpy(text_name, name);
+    sprintf(name, "END_%03d.dat", aid);
+    if ((write_record(auction_fd, name, &record, sizeof(record)) == ERROR) ||
+            (unlinkat(auction_fd, text_name, 0) == -1)) {
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Converts the text records of an auction, if it still has any.
+ * Returns:
+ * - ERROR if a general error occurred, the text files are then left in place.
+ * - NOT_FOUND if there is no text start record.
+ * - SUCCESS otherwise.
+*/
+int convert_text_auction(int auction_fd, int aid) {
+    char name[BUFSIZ_S];
+    start_record_t record = { 0 };
+    long value, timeactive, start;
+
+    if (auction_fd == -1) {
+        return ERROR;
+    }
+
+    // uid name fname value timeactive date time start
+    sprintf(name, "START_%03d.txt", aid);
+    FILE *fp = fopen_at(auction_fd, name, O_RDONLY, "r");
+    if (fp == NULL) {
+        return (errno == ENOENT) ? NOT_FOUND : ERROR;
+    }
+
+    int n = fscanf(fp, "%6s %10s %24s %ld %ld %*s %*s %ld", record.uid, record.name, record.fname,
+        &value, &timeactive, &start);
+    fclose(fp);
+    if (n != 6) {
+        return ERROR;
+    }
+
+    record.value = value;
+    record.timeactive = timeactive;
+    record.start = start;
+
+    if ((convert_text_bids(auction_fd, start) == ERROR) ||
+            (convert_text_end(auction_fd, aid, start) == ERROR)) {
+        return ERROR;
+    }
+
+    char text_name[BUFSIZ_S];
+    strcpy(text_name, name);
+    sprintf(name, "START_%03d.dat", aid);
+    if ((write_record(auction_fd, name, &record, sizeof(record)) == ERROR) ||
+            (unlinkat(auction_fd, text_name, 0) == -1)) {
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int dir_load_auctions() {
+    struct dirent **filelist;
+    char name[BUFSIZ_S];
+    start_record_t record;
+
+    int n_entries = scandirat(fsdir_auctions(), ".", &filelist, 0, alphasort);
+    if (n_entries < 0) {
+        perror("scandirat");
+        return ERROR;
+    }
+
+    for (int iter = 0; iter < n_entries; iter++) {
+        if ((strlen(filelist[iter]->d_name) == AUCTION_ID_LEN) &&
+                validate_auction_id(filelist[iter]->d_name)) {
+            int aid = atoi(filelist[iter]->d_name);
+            int auction_fd = fsdir_auction(aid);
+
+            int ret = convert_text_auction(auction_fd, aid);
+            if (ret != ERROR) {
+                sprintf(name, "START_%03d.dat", aid);
+                ret = read_record(auction_fd, name, &record, sizeof(record));
+            }
+
+            if (ret == NOT_FOUND) {
+                // upload interrupted by a restart
+                dir_cancel_auction(aid);
+            } else if (ret == ERROR) {
+                // left on disk, so that the ID is not handed out again
+                printf("ERROR: could not load auction %03d\n", aid);
+            } else {
+                index_open(aid, record.uid, record.start, record.timeactive, record.value);
+                index_set_max_bid(aid, read_max_bid_value(aid, record.value));
+
+                sprintf(name, "END_%03d.dat", aid);
+                if (file_exists(auction_fd, name) == SUCCESS) {
+                    index_close(aid);
+                }
+            }
+        }
+        free(filelist[iter]);
+    }
+    free(filelist);
+
+    return SUCCESS;
+}
+
+/* ---- Bids ---- */
+
+int dir_add_bid(int aid, bid_record_t *record) {
+    char bid_filename[60];
+
+    if (bid_storage == BIDS_LOG) {
+        return bidlog_append_bid(aid, record);
+    }
+
+    sprintf(bid_filename, "BIDS/%06u.dat", record->value);
+    return write_record(fsdir_auction(aid), bid_filename, record, sizeof(bid_record_t));
+}
+
+int dir_add_bidded(char *uid, int aid) {
+    char bidded_filename[60];
+
+    if (bid_storage == BIDS_LOG) {
+        return bidlog_append_bidded(uid, aid);
+    }
+
+    sprintf(bidded_filename, "BIDDED/%03d.txt", aid);
+    return touch_at(fsdir_user(uid), bidded_filename);
+}
+
+// extract information about the first bids placed in a given auction
+int dir_read_bids(int aid, bid_info_t *bids, int offset, int max) {
+    struct dirent **filelist;
+    bid_record_t record;
+    int n_bids = 0, iter = 0;
+
+    if (bid_storage == BIDS_LOG) {
+        bid_record_t records[max];
+        if ((n_bids = bidlog_read_bids(aid, records, offset, max)) <= 0)
+            return ERROR;
+
+        for (int i = 0; i < n_bids; i++) {
+            bid_record_info(&records[i], &bids[i]);
+        }
+
+        return n_bids;
+    }
+
+    int auction_fd = fsdir_auction(aid);
+    if (auction_fd == -1) {
+        return ERROR;
+    }
+
+    int bids_fd = openat(auction_fd, "BIDS", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (bids_fd == -1) {
+        return ERROR;
+    }
+
+    // bids are listed in ascending order of value
+    int n_entries = scandirat(bids_fd, ".", &filelist, 0, alphasort);
+    if (n_entries <= 0) {
+        close(bids_fd);
+        return ERROR;
+    }
+
+    // only the files in the window are opened
+    while (iter < n_entries) {
+        if (is_bid_file(filelist[iter]->d_name) && (offset > 0)) {
+            offset--;
+        } else if ((n_bids < max) && is_bid_file(filelist[iter]->d_name)) {
+            if (read_record(bids_fd, filelist[iter]->d_name, &record, sizeof(record)) == SUCCESS) {
+                bid_record_info(&record, &bids[n_bids]);
+                n_bids++;
+            }
+        }
+        free(filelist[iter]);
+        iter++;
+    }
+    free(filelist);
+    close(bids_fd);
+
+    return n_bids;
+}
+
+// mark the auctions on which given user has placed bids
+int dir_read_bidded(char *uid, char *bidded) {
+    int count = 0;
+
+    if (bid_storage == BIDS_LOG) {
+        return bidlog_read_bidded(uid, bidded);
+    }
+
+    int user_fd = fsdir_user(uid);
+    int fd = (user_fd == -1) ? -1 : openat(user_fd, "BIDDED", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return (errno == ENOENT) ? 0 : ERROR; // never bid
+
+    // order does not matter here, so the entries are not sorted
+    DIR *d = fdopendir(fd);
+    if (d == NULL) {
+        close(fd);
+        return ERROR;
+    }
+
+    struct dirent *p;
+    while ((p = readdir(d))) {
+        if (strlen(p->d_name) == AUCTION_ID_LEN + 4) { // AID.txt
+            int aid = atoi(p->d_name);
+            if ((aid >= 1) && (aid <= MAX_AUCTIONS) && !bidded[aid]) {
+                bidded[aid] = 1;
+                count++;
+            }
+        }
+    }
+    closedir(d);
+
+    return count;
+}
+
+/* ---- Assets ---- */
+
+/* Returns a descriptor to write the asset of a reserved auction, or -1 on error. */
+int dir_create_asset(int aid, char *fname) {
+    char name[BUFSIZ_S];
+    sprintf(name, "ASSET/%s", fname);
+
+    int auction_fd = fsdir_auction(aid);
+    int fd = (auction_fd == -1) ? -1 :
+        openat(auction_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        perror("openat");
+    }
+
+    return fd;
+}
+
+/* Returns a descriptor to read the asset of an auction, or -1 on error. */
+int dir_open_asset(int aid, char *fname, off_t *fsize) {
+    int auction_fd = fsdir_auction(aid);
+    int asset_fd = (auction_fd == -1) ? -1 :
+        openat(auction_fd, "ASSET", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (asset_fd == -1) {
+        return -1;
+    }
+
+    DIR *d = fdopendir(asset_fd);
+    if (d == NULL) {
+        close(asset_fd);
+        return -1;
+    }
+
+    struct dirent *p;
+    fname[0] = '\0';
+    while ((p = readdir(d))) {
+        if (!validate_file_name(p->d_name)) {
+            continue;
+        }
+        strcpy(fname, p->d_name);
+        break;
+    }
+
+    // opened before closedir() releases the directory descriptor
+    int fd = (fname[0] == '\0') ? -1 : openat(asset_fd, fname, O_RDONLY | O_CLOEXEC);
+    closedir(d);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    *fsize = statbuf.st_size;
+    return fd;
+}
+
+storage_backend_t dir_backend = {
+    .name = "dir",
+    .init = dir_init,
+    .sync = dir_sync,
+    .users_table = DIR_USERS_TABLE,
+    .generation = dir_generation,
+
+    .is_registered = dir_is_registered,
+    .is_logged_in = dir_is_logged_in,
+    .register_user = dir_register_user,
+    .unregister_user = dir_unregister_user,
+    .get_password = dir_get_password,
+    .set_login = dir_set_login,
+    .erase_login = dir_erase_login,
+
+    .reserve_auction = dir_reserve_auction,
+    .cancel_auction = dir_cancel_auction,
+    .write_start = dir_write_start,
+    .read_start = dir_read_start,
+    .write_end = dir_write_end,
+    .read_end = dir_read_end,
+    .add_hosted = dir_add_hosted,
+    .load_auctions = dir_load_auctions,
+
+    .add_bid = dir_add_bid,
+    .add_bidded = dir_add_bidded,
+    .read_bids = dir_read_bids,
+    .read_bidded = dir_read_bidded,
+
+    .create_asset = dir_create_asset,
+    .open_asset = dir_open_asset
+};
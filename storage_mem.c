@@ -0,0 +1,657 @@
+#define _GNU_SOURCE // memfd_create(), MAP_NORESERVE, syncfs()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "storage.h"
+#include "index.h"
+#include "utils.h"
+
+/*
+ * Backends keeping every record in one region shared by all the server processes: fixed-size
+ * tables of users and auctions, followed by the bids, which grow by STORE_BIDS_CHUNK at a time.
+ * The memory backend maps an anonymous file, while the file backend maps STORE_FILE so it
+ * survives restarts. Every process maps the region up to STORE_MAX_BIDS before forking, so
+ * growing the file never moves it. Assets are too large for the region and are kept as
+ * ASSETS/<aid>. The file backend's users table is kept in STORE_USERS_FILE, tied to the store
+ * by the generation drawn when the store was created.
+ */
+
+#define STORE_FILE "auctions.db"
+#define STORE_UPGRADE_FILE "auctions.db.new"
+#define STORE_USERS_FILE "auctions_users.db"
+#define STORE_MAGIC 0x41554354
+#define STORE_VERSION 3
+
+// values are strictly increasing and at most 999999, which bounds the bids of an auction
+#define STORE_MAX_BIDS (MAX_AUCTIONS * 999999)
+#define STORE_BIDS_CHUNK 65536
+
+// layout of version 1 and 2 stores, upgraded on open
+#define LEGACY_MAX_USERS 4096
+#define LEGACY_MAX_BIDS 65536
+
+#define SLOT_FREE 0
+#define SLOT_UNREGISTERED 1
+#define SLOT_REGISTERED 2
+
+typedef struct {
+	int state;
+	int logged_in;
+	char uid[USER_ID_LEN+1];
+	char pwd[USER_PWD_LEN+1];
+	unsigned char bidded[MAX_AUCTIONS/8 + 1];
+} store_user_t;
+
+typedef struct {
+	int state;
+	start_info_t start_info;
+	int64_t start;
+	end_info_t end_info;
+	int first_bid;
+	int last_bid;
+} store_auction_t;
+
+typedef struct {
+	bid_record_t record;
+	int next;
+} store_bid_t;
+
+/* Users are direct-addressed by UID, their pages are only backed once touched. */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	int lock;
+	int n_bids;
+	int bids_capacity; // the file is at least STORE_SIZE(bids_capacity) long
+	uint64_t generation;
+	store_user_t users[MAX_USERS];
+	store_auction_t auctions[MAX_AUCTIONS+1];
+} store_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	int lock;
+	int n_bids;
+	store_user_t users[LEGACY_MAX_USERS]; // open addressing on the numeric UID
+	store_auction_t auctions[MAX_AUCTIONS+1];
+	store_bid_t bids[LEGACY_MAX_BIDS];
+	uint64_t generation; // version 2 only
+} legacy_store_t;
+
+#define STORE_SIZE(n_bids) ((off_t) sizeof(store_t) + (off_t) (n_bids) * (off_t) sizeof(store_bid_t))
+
+static store_t *store = NULL;
+static store_bid_t *store_bids = NULL;
+static int store_fd = -1;
+
+/* ---- Utils ---- */
+
+// critical sections are a few stores long, so spinning is cheaper than a process-shared mutex
+void store_lock() {
+    while (__atomic_test_and_set(&store->lock, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+void store_unlock() {
+    __atomic_clear(&store->lock, __ATOMIC_RELEASE);
+}
+
+// maps the whole reserved range, the caller sizes the file
+int map_store(int fd) {
+    store = mmap(NULL, STORE_SIZE(STORE_MAX_BIDS), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE,
+        fd, 0);
+    if (store == MAP_FAILED) {
+        perror("mmap");
+        return ERROR;
+    }
+
+    store_bids = (store_bid_t *) (store + 1);
+    return SUCCESS;
+}
+
+// the file is fresh, so the tables are already zeroed
+int store_reset(int fd) {
+    if (ftruncate(fd, STORE_SIZE(STORE_BIDS_CHUNK)) == -1) {
+        perror("ftruncate");
+        return ERROR;
+    }
+
+    if (map_store(fd) == ERROR) {
+        return ERROR;
+    }
+
+    store->magic = STORE_MAGIC;
+    store->version = STORE_VERSION;
+    store->bids_capacity = STORE_BIDS_CHUNK;
+    store->generation = new_generation();
+    return SUCCESS;
+}
+
+// the caller must hold the lock
+int grow_bids() {
+    if (store->bids_capacity == STORE_MAX_BIDS) {
+        return ERROR;
+    }
+
+    int capacity = store->bids_capacity + STORE_BIDS_CHUNK;
+    if (capacity > STORE_MAX_BIDS) {
+        capacity = STORE_MAX_BIDS;
+    }
+
+    // the other processes already map the whole range, so they see the new bids right away
+    if (ftruncate(store_fd, STORE_SIZE(capacity)) == -1) {
+        perror("ftruncate");
+        return ERROR;
+    }
+
+    store->bids_capacity = capacity;
+    return SUCCESS;
+}
+
+/* Rewrites a version 1 or 2 store into STORE_FILE, returning the descriptor of the new one. */
+int upgrade_store(int old_fd, off_t size) {
+    legacy_store_t *old = mmap(NULL, size, PROT_READ, MAP_PRIVATE, old_fd, 0);
+    if (old == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    int fd = open(STORE_UPGRADE_FILE, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        perror("open");
+    }
+
+    if ((fd == -1) || (store_reset(fd) == ERROR)) {
+        munmap(old, size);
+        return -1;
+    }
+
+    // version 1 stores have no generation, and no users table to be tied to
+    if (old->version == 2) {
+        store->generation = old->generation;
+    }
+
+    for (int i = 0; i < LEGACY_MAX_USERS; i++) {
+        if (old->users[i].state != SLOT_FREE) {
+            store->users[atoi(old->users[i].uid)] = old->users[i];
+        }
+    }
+
+    // the bid indices are kept, the chains stay valid
+    memcpy(store->auctions, old->auctions, sizeof(store->auctions));
+    memcpy(store_bids, old->bids, old->n_bids * sizeof(store_bid_t));
+    store->n_bids = old->n_bids;
+    munmap(old, size);
+
+    if ((fsync(fd) == -1) || (rename(STORE_UPGRADE_FILE, STORE_FILE) == -1)) {
+        perror("rename");
+        close(fd);
+        return -1;
+    }
+
+    close(old_fd);
+    return fd;
+}
+
+int create_assets_dir() {
+    if ((mkdir("ASSETS", S_IRWXU) == -1) && (errno != EEXIST)) {
+        perror("mkdir");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+int mem_init() {
+    // a file rather than an anonymous mapping, so that the bids grow the same way
+    store_fd = memfd_create(STORE_FILE, 0);
+    if (store_fd == -1) {
+        perror("memfd_create");
+        return ERROR;
+    }
+
+    if (store_reset(store_fd) == ERROR) {
+        return ERROR;
+    }
+
+    return create_assets_dir();
+}
+
+int file_init() {
+    struct stat statbuf;
+    uint32_t header[2]; // magic and version, common to every layout
+
+    int fd = open(STORE_FILE, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if ((fd == -1) || (fstat(fd, &statbuf) == -1)) {
+        perror("open");
+        return ERROR;
+    }
+
+    // kept open to grow the bids, and to flush the mapping and the assets next to it
+    store_fd = fd;
+    if (statbuf.st_size == 0) {
+        return (store_reset(fd) == ERROR) ? ERROR : create_assets_dir();
+    }
+
+    // version 1 stores are version 2 ones without the generation
+    if ((pread(fd, header, sizeof(header), 0) == sizeof(header)) && (header[0] == STORE_MAGIC) &&
+            (((header[1] == 1) && (statbuf.st_size == offsetof(legacy_store_t, generation))) ||
+            ((header[1] == 2) && (statbuf.st_size == sizeof(legacy_store_t))))) {
+        store_fd = upgrade_store(fd, statbuf.st_size);
+        if (store_fd == -1) {
+            return ERROR;
+        }
+    } else if (map_store(fd) == ERROR) {
+        return ERROR;
+    } else if ((statbuf.st_size < STORE_SIZE(0)) || (store->magic != STORE_MAGIC) ||
+            (store->version != STORE_VERSION) || (statbuf.st_size < STORE_SIZE(store->bids_capacity))) {
+        printf("ERROR: %s was not written by this server version\n", STORE_FILE);
+        return ERROR;
+    }
+
+    // the previous server may have died while holding it
+    store->lock = 0;
+    return create_assets_dir();
+}
+
+uint64_t mem_generation() {
+    return store->generation;
+}
+
+// nothing outlives the process anyway
+int mem_sync() {
+    return SUCCESS;
+}
+
+// the mapping and ASSETS/ are on the same file system, one call flushes both
+int file_sync() {
+    if (syncfs(store_fd) == -1) {
+        perror("syncfs");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/* ---- Users ---- */
+
+// direct-addressed by the numeric UID like the users table, the caller must hold the lock
+store_user_t *find_slot(char *uid, int create) {
+    int slot = atoi(uid);
+    if ((slot < 0) || (slot >= MAX_USERS)) return NULL;
+
+    store_user_t *user = &store->users[slot];
+    if (user->state == SLOT_FREE) {
+        if (!create) return NULL;
+        strcpy(user->uid, uid);
+        user->state = SLOT_UNREGISTERED;
+    }
+
+    return user;
+}
+
+int mem_is_registered(char *uid) {
+    store_lock();
+    store_user_t *user = find_slot(uid, 0);
+    int ret = (user && (user->state == SLOT_REGISTERED)) ? SUCCESS : NOT_FOUND;
+    store_unlock();
+
+    return ret;
+}
+
+int mem_is_logged_in(char *uid) {
+    store_lock();
+    store_user_t *user = find_slot(uid, 0);
+    int ret = (user && user->logged_in) ? SUCCESS : NOT_FOUND;
+    store_unlock();
+
+    return ret;
+}
+
+int mem_register_user(char *uid, char *pwd) {
+    store_lock();
+    store_user_t *user = find_slot(uid, 1);
+    if (user) {
+        strcpy(user->pwd, pwd);
+        user->state = SLOT_REGISTERED;
+    }
+    store_unlock();
+
+    return user ? SUCCESS : ERROR;
+}
+
+int mem_unregister_user(char *uid) {
+    store_lock();
+    store_user_t *user = find_slot(uid, 0);
+    if (user) {
+        memset(user->pwd, 0, sizeof(user->pwd));
+        user->state = SLOT_UNREGISTERED;
+    }
+    store_unlock();
+
+    return SUCCESS;
+}
+
+int mem_get_password(char *uid, char *pwd) {
+    int ret = ERR_USER_NOT_REGISTERED;
+
+    store_lock();
+    store_user_t *user = find_slot(uid, 0);
+    if (user && (user->state == SLOT_REGISTERED)) {
+        strcpy(pwd, user->pwd);
+        ret = SUCCESS;
+    }
+    store_unlock();
+
+    return ret;
+}
+
+int set_logged_in(char *uid, int logged_in) {
+    store_lock();
+    store_user_t *user = find_slot(uid, 0);
+    if (user) {
+        user->logged_in = logged_in;
+    }
+    store_unlock();
+
+    return user ? SUCCESS : ERROR;
+}
+
+int mem_set_login(char *uid) {
+    return set_logged_in(uid, 1);
+}
+
+int mem_erase_login(char *uid) {
+    set_logged_in(uid, 0);
+    return SUCCESS;
+}
+
+/* ---- Auctions ---- */
+
+void asset_path(int aid, char *pathname) {
+    sprintf(pathname, "ASSETS/%03d", aid);
+}
+
+int mem_reserve_auction(int aid) {
+    int expected = ENTRY_FREE;
+
+    if (!__atomic_compare_exchange_n(&store->auctions[aid].state, &expected, ENTRY_RESERVED,
+            0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return ERR_AUCTION_EXISTS;
+    }
+
+    return SUCCESS;
+}
+
+int mem_cancel_auction(int aid) {
+    char pathname[BUFSIZ_S];
+    asset_path(aid, pathname);
+    unlink(pathname);
+
+    memset(&store->auctions[aid], 0, sizeof(store_auction_t));
+    __atomic_store_n(&store->auctions[aid].state, ENTRY_FREE, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+int mem_write_start(int aid, start_info_t *auction, time_t start) {
+    store_auction_t *entry = &store->auctions[aid];
+
+    entry->start_info = *auction;
+    strftime(entry->start_info.date, sizeof(entry->start_info.date), "%Y-%m-%d", localtime(&start));
+    strftime(entry->start_info.time, sizeof(entry->start_info.time), "%H:%M:%S", localtime(&start));
+    entry->start = start;
+    entry->first_bid = -1;
+    entry->last_bid = -1;
+
+    __atomic_store_n(&entry->state, ENTRY_OPEN, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+int mem_read_start(int aid, start_info_t *start_info) {
+    int state = __atomic_load_n(&store->auctions[aid].state, __ATOMIC_ACQUIRE);
+    if ((state != ENTRY_OPEN) && (state != ENTRY_CLOSED)) {
+        return ERROR;
+    }
+
+    *start_info = store->auctions[aid].start_info;
+    return SUCCESS;
+}
+
+int mem_write_end(int aid, time_t end, long elapsed) {
+    store_auction_t *entry = &store->auctions[aid];
+
+    strftime(entry->end_info.date, sizeof(entry->end_info.date), "%Y-%m-%d", localtime(&end));
+    strftime(entry->end_info.time, sizeof(entry->end_info.time), "%H:%M:%S", localtime(&end));
+    sprintf(entry->end_info.sec_time, "%ld", elapsed);
+
+    __atomic_store_n(&entry->state, ENTRY_CLOSED, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+int mem_read_end(int aid, end_info_t *end_info) {
+    if (__atomic_load_n(&store->auctions[aid].state, __ATOMIC_ACQUIRE) != ENTRY_CLOSED) {
+        return NOT_FOUND;
+    }
+
+    *end_info = store->auctions[aid].end_info;
+    return SUCCESS;
+}
+
+// the owner is part of the start record
+int mem_add_hosted(char *uid, int aid) {
+    (void) uid;
+    (void) aid;
+    return SUCCESS;
+}
+
+int mem_load_auctions() {
+    for (int aid = 1; aid <= MAX_AUCTIONS; aid++) {
+        store_auction_t *entry = &store->auctions[aid];
+
+        if (entry->state == ENTRY_RESERVED) {
+            // upload interrupted by a restart
+            mem_cancel_auction(aid);
+        } else if ((entry->state == ENTRY_OPEN) || (entry->state == ENTRY_CLOSED)) {
+            index_open(aid, entry->start_info.uid, entry->start, atol(entry->start_info.timeactive),
+                atol(entry->start_info.value));
+
+            // concurrent bids may be linked slightly out of order
+            for (int i = entry->first_bid; i != -1; i = store_bids[i].next) {
+                index_raise_max_bid(aid, store_bids[i].record.value, NULL);
+            }
+
+            if (entry->state == ENTRY_CLOSED) {
+                index_close(aid);
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+/* ---- Bids ---- */
+
+int mem_add_bid(int aid, bid_record_t *record) {
+    store_auction_t *entry = &store->auctions[aid];
+
+    store_lock();
+    if ((store->n_bids == store->bids_capacity) && (grow_bids() == ERROR)) {
+        store_unlock();
+        return ERROR;
+    }
+
+    int i = store->n_bids++;
+    store_bids[i].record = *record;
+    store_bids[i].next = -1;
+
+    if (entry->last_bid == -1) {
+        entry->first_bid = i;
+    } else {
+        store_bids[entry->last_bid].next = i;
+    }
+    entry->last_bid = i;
+    store_unlock();
+
+    return SUCCESS;
+}
+
+int mem_add_bidded(char *uid, int aid) {
+    store_lock();
+    store_user_t *user = find_slot(uid, 0);
+    if (user) {
+        user->bidded[aid / 8] |= 1 << (aid % 8);
+    }
+    store_unlock();
+
+    return user ? SUCCESS : ERROR;
+}
+
+int mem_read_bids(int aid, bid_info_t *bids, int offset, int max) {
+    int n_bids = 0;
+
+    store_lock();
+    for (int i = store->auctions[aid].first_bid; (i != -1) && (n_bids < max); i = store_bids[i].next) {
+        if (offset > 0) {
+            offset--;
+            continue;
+        }
+        bid_record_info(&store_bids[i].record, &bids[n_bids++]);
+    }
+    store_unlock();
+
+    return (n_bids > 0) ? n_bids : ERROR;
+}
+
+int mem_read_bidded(char *uid, char *bidded) {
+    int count = 0;
+
+    store_lock();
+    store_user_t *user = find_slot(uid, 0);
+    for (int aid = 1; user && (aid <= MAX_AUCTIONS); aid++) {
+        if ((user->bidded[aid / 8] & (1 << (aid % 8))) && !bidded[aid]) {
+            bidded[aid] = 1;
+            count++;
+        }
+    }
+    store_unlock();
+
+    return count;
+}
+
+/* ---- Assets ---- */
+
+int mem_create_asset(int aid, char *fname) {
+    char pathname[BUFSIZ_S];
+    (void) fname;
+
+    asset_path(aid, pathname);
+    int fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        perror("open");
+    }
+
+    return fd;
+}
+
+int mem_open_asset(int aid, char *fname, off_t *fsize) {
+    char pathname[BUFSIZ_S];
+    struct stat statbuf;
+
+    start_info_t start_info;
+    if (mem_read_start(aid, &start_info) == ERROR) {
+        return -1;
+    }
+    strcpy(fname, start_info.fname);
+
+    asset_path(aid, pathname);
+    int fd = open(pathname, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (fstat(fd, &statbuf) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    *fsize = statbuf.st_size;
+    return fd;
+}
+
+storage_backend_t memory_backend = {
+    .name = "memory",
+    .init = mem_init,
+    .sync = mem_sync,
+    .users_table = NULL,
+    .generation = mem_generation,
+
+    .is_registered = mem_is_registered,
+    .is_logged_in = mem_is_logged_in,
+    .register_user = mem_register_user,
+    .unregister_user = mem_unregister_user,
+    .get_password = mem_get_password,
+    .set_login = mem_set_login,
+    .erase_login = mem_erase_login,
+
+    .reserve_auction = mem_reserve_auction,
+    .cancel_auction = mem_cancel_auction,
+    .write_start = mem_write_start,
+    .read_start = mem_read_start,
+    .write_end = mem_write_end,
+    .read_end = mem_read_end,
+    .add_hosted = mem_add_hosted,
+    .load_auctions = mem_load_auctions,
+
+    .add_bid = mem_add_bid,
+    .add_bidded = mem_add_bidded,
+    .read_bids = mem_read_bids,
+    .read_bidded = mem_read_bidded,
+
+    .create_asset = mem_create_asset,
+    .open_asset = mem_open_asset
+};
+
+// identical to the memory backend, only the mapping differs
+storage_backend_t file_backend = {
+    .name = "file",
+    .init = file_init,
+    .sync = file_sync,
+    .users_table = STORE_USERS_FILE,
+    .generation = mem_generation,
+
+    .is_registered = mem_is_registered,
+    .is_logged_in = mem_is_logged_in,
+    .register_user = mem_register_user,
+    .unregister_user = mem_unregister_user,
+    .get_password = mem_get_password,
+    .set_login = mem_set_login,
+    .erase_login = mem_erase_login,
+
+    .reserve_auction = mem_reserve_auction,
+    .cancel_auction = mem_cancel_auction,
+    .write_start = mem_write_start,
+    .read_start = mem_read_start,
+    .write_end = mem_write_end,
+    .read_end = mem_read_end,
+    .add_hosted = mem_add_hosted,
+    .load_auctions = mem_load_auctions,
+
+    .add_bid = mem_add_bid,
+    .add_bidded = mem_add_bidded,
+    .read_bids = mem_read_bids,
+    .read_bidded = mem_read_bidded,
+
+    .create_asset = mem_create_asset,
+    .open_asset = mem_open_asset
+};
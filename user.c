@@ -935,16 +935,28 @@ void command_bid(char *aid, char *value) {
 
 }
 
-/* show_record <aid> OR sr <aid> */
-void command_show_record(char *aid) {
+/* show_record <aid> [offset [limit]] OR sr <aid> [offset [limit]] */
+void command_show_record(char *aid, char *offset, char *limit) {
     if (!validate_auction_id(aid)) {
         printf(INVALID_AUCTION_ID);
         return;
     }
 
+    if ((offset && !validate_record_offset(offset)) || (limit && !validate_record_limit(limit))) {
+        printf(INCORRECT_SYNTAX_OR_INVALID_VALUES);
+        return;
+    }
+
     // build message to send
     char buffer[BUFSIZ_L];
-    int printed = sprintf(buffer, "SRC %s\n", aid);
+    int printed;
+    if (limit) {
+        printed = sprintf(buffer, "SRC %s %s %s\n", aid, offset, limit);
+    } else if (offset) {
+        printed = sprintf(buffer, "SRC %s %s\n", aid, offset);
+    } else {
+        printed = sprintf(buffer, "SRC %s\n", aid);
+    }
     if (printed < 0) {
         printf(ERROR_SPRINTF);
         return;
@@ -998,12 +1010,13 @@ void command_show_record(char *aid) {
             return;
         }
 
-        char *bidder_uid[50];
-        char *bid_value[50];
-        char *bid_date[50];
-        char *bid_time[50];
-        char *bid_elapsed_time[50];
+        char *bidder_uid[RECORD_BIDS_MAX];
+        char *bid_value[RECORD_BIDS_MAX];
+        char *bid_date[RECORD_BIDS_MAX];
+        char *bid_time[RECORD_BIDS_MAX];
+        char *bid_elapsed_time[RECORD_BIDS_MAX];
         int bid_count = 0;
+        char *next_offset = NULL;
 
         char *end_date;
         char *end_time;
@@ -1013,6 +1026,11 @@ void command_show_record(char *aid) {
         char *next;
         while ((next = strtok(NULL, delim))) {
             if (!strcmp(next, "B")) {
+                if ((bid_count == RECORD_BIDS_MAX) || next_offset) {
+                    printf(INVALID_PROTOCOL_MSG);
+                    return;
+                }
+
                 bidder_uid[bid_count] = strtok(NULL, delim);
                 bid_value[bid_count] = strtok(NULL, delim);
                 bid_date[bid_count] = strtok(NULL, delim);
@@ -1029,6 +1047,13 @@ void command_show_record(char *aid) {
                 }
 
                 bid_count++;
+            } else if (!strcmp(next, "M") && !next_offset) {
+                next_offset = strtok(NULL, delim);
+
+                if (!validate_record_offset(next_offset)) {
+                    printf(INVALID_PROTOCOL_MSG);
+                    return;
+                }
             } else if (!strcmp(next, "E")) {
                 end_date = strtok(NULL, delim);
                 end_time = strtok(NULL, delim);
@@ -1054,7 +1079,9 @@ void command_show_record(char *aid) {
         printf(" -> starting with value %s and lasting at most %s seconds.\n", start_value, timeactive);
         printf(" -> named \"%s\" with asset \"%s\".\n", auction_name, asset_fname);
 
-        if ((!bid_count) && ended) {
+        if ((!bid_count) && offset) {
+            printf("No bids were placed in this auction past the first %s.\n", offset);
+        } else if ((!bid_count) && ended) {
             printf("No bids were placed in this auction.\n");
         } else if (!bid_count) {
             printf("No bids have been placed in this auction yet.\n");
@@ -1065,6 +1092,9 @@ void command_show_record(char *aid) {
             printf(" - Bid placed by user %s, with value %s, on %s, %s, with %s seconds elapsed.\n", 
                     bidder_uid[i], bid_value[i], bid_date[i], bid_time[i], bid_elapsed_time[i]);
         }
+        if (next_offset) {
+            printf("More bids available, type 'show_record %s %s' to see them.\n", aid, next_offset);
+        }
 
         if (ended) {
             printf("Ended on %s, %s, %s seconds after being started.\n", end_date, end_time, end_elapsed_time);
@@ -1092,7 +1122,7 @@ void command_help() {
     printf("• list | List all auctions ever created.\n");
     printf("• show_asset <auction-id> | Show auction asset.\n");
     printf("• bid <auction id> <bid-value> | Place a bid.\n");
-    printf("• show_record <auction-id> | Show info about an auction.\n");
+    printf("• show_record <auction-id> [offset [limit]] | Show info about an auction.\n");
 }
 
 /* ---- Command Listener ---- */
@@ -1140,7 +1170,9 @@ void command_listener() {
             command_bid(aid, value);
         } else if (!strcmp("show_record", label) || !strcmp("sr", label)) {
             char *aid = strtok(NULL, delim);
-            command_show_record(aid);
+            char *offset = strtok(NULL, delim);
+            char *limit = strtok(NULL, delim);
+            command_show_record(aid, offset, limit);
         } else if (!strcmp("help", label)) {
             command_help();
         } else {
@@ -1,6 +1,11 @@
+#define _GNU_SOURCE // splice()
+
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
@@ -68,23 +73,99 @@ ssize_t read_file_data(int sockfd, FILE *file, off_t nbytes) {
     return nbytes;
 }
 
-ssize_t write_file_data(int sockfd, FILE *file, off_t nbytes) {
-    size_t to_write;
-    char buffer[BUFSIZ_L];
-    while (nbytes > 0) {
-        to_write = (nbytes > BUFSIZ_L) ? BUFSIZ_L : nbytes;
+/**
+ * Moves up to nbytes from the socket to the file through a pipe with splice(), so that the data
+ * never reaches user space. Falls back to read()/write() through a buffer if the kernel cannot
+ * splice them. Stops early if the socket would block.
+ * Returns the number of bytes moved, 0 if the connection was closed, or -1 on error.
+*/
+ssize_t splice_file_data(int sockfd, int fd, off_t nbytes) {
+    static int pipefd[2] = { -1, -1 };
+    static int can_splice = 1;
+
+    if (can_splice && (pipefd[0] == -1) && (pipe(pipefd) == -1)) {
+        can_splice = 0;
+    }
 
-        if (fread(buffer, sizeof(char), to_write, file) < to_write) {
-            perror("fread");
-            return nbytes;
+    if (can_splice) {
+        ssize_t res = splice(sockfd, NULL, pipefd[1], NULL, nbytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if ((res == -1) && ((errno == EINVAL) || (errno == ENOSYS))) {
+            can_splice = 0;
+        } else if (res <= 0) {
+            return res;
+        } else {
+            // the pipe is shared, so it must be fully drained into the file before returning
+            ssize_t moved = 0;
+            while (moved < res) {
+                ssize_t ret = splice(pipefd[0], NULL, fd, NULL, res - moved, SPLICE_F_MOVE);
+                if (ret <= 0) {
+                    close(pipefd[0]);
+                    close(pipefd[1]);
+                    pipefd[0] = pipefd[1] = -1;
+                    return -1;
+                }
+                moved += ret;
+            }
+            return res;
         }
+    }
+
+    char buffer[BUFSIZ_L];
+    ssize_t res = read(sockfd, buffer, (nbytes > BUFSIZ_L) ? BUFSIZ_L : nbytes);
+    if (res <= 0) return res;
+
+    if (write_all_bytes(fd, buffer, res) == -1) {
+        perror("write");
+        return -1;
+    }
+
+    return res;
+}
 
-        if (write_all_bytes(sockfd, buffer, to_write) == -1) {
-            perror("write");
-            return nbytes;
+/**
+ * Sends nbytes of the file starting at *offset straight to the socket, without copying them to
+ * user space. Stops early if the socket would block.
+ * Returns the number of bytes sent (advancing *offset), or -1 if none could be sent.
+*/
+ssize_t send_file_data(int sockfd, int fd, off_t *offset, off_t nbytes) {
+    ssize_t res, sent = 0;
+    while (sent < nbytes) {
+        res = sendfile(sockfd, fd, offset, nbytes - sent);
+        if (res == -1) return (sent > 0) ? sent : -1;
+        if (res == 0) break; // file is shorter than expected
+        sent += res;
+    }
+
+    return sent;
+}
+
+/* ---- Framing ---- */
+
+/**
+ * Incremental reader for TCP requests: given the bytes received so far, returns the length of
+ * the request frame once it is complete, or 0 if more bytes are needed.
+ * CLS, SAS and BID end with an end-of-line character. The frame of OPA ends right after the
+ * <fsize> field, since the file data that follows is streamed separately by the caller.
+ * Anything else is unknown and complete as soon as its label is received.
+*/
+ssize_t request_frame_length(char *buffer, ssize_t nbytes) {
+    char *end = memchr(buffer, '\n', nbytes);
+
+    if (nbytes < 4) {
+        return end ? (end - buffer + 1) : 0;
+    }
+
+    if (!strncmp(buffer, "OPA ", 4)) {
+        int spaces = 0;
+        for (ssize_t i = 0; i < nbytes; i++) {
+            if (buffer[i] == '\n') return i + 1; // malformed header
+            if ((buffer[i] == ' ') && (++spaces == OPA_HEADER_FIELDS)) return i + 1;
         }
+        return 0;
+    }
 
-        nbytes -= to_write;
+    if (!strncmp(buffer, "CLS ", 4) || !strncmp(buffer, "SAS ", 4) || !strncmp(buffer, "BID ", 4)) {
+        return end ? (end - buffer + 1) : 0;
     }
 
     return nbytes;
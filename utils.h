@@ -5,6 +5,9 @@
 #define BUFSIZ_M 2048
 #define BUFSIZ_L 6144
 
+/* Fields of "OPA <uid> <pwd> <name> <start_value> <timeactive> <fname> <fsize> " */
+#define OPA_HEADER_FIELDS 8
+
 #define ERROR_COMMAND_NOT_FOUND \
     "Unknown command. Type 'help' for a list of commands available.\n"
 #define ERROR_ALREADY_LOGGED_IN "You are already logged in.\n"
@@ -34,7 +37,11 @@ ssize_t write_all_bytes(int fd, char *buffer, ssize_t nbytes);
 
 ssize_t read_file_data(int sockfd, FILE *file, off_t nbytes);
 
-ssize_t write_file_data(int sockfd, FILE *file, off_t nbytes);
+ssize_t splice_file_data(int sockfd, int fd, off_t nbytes);
+
+ssize_t send_file_data(int sockfd, int fd, off_t *offset, off_t nbytes);
+
+ssize_t request_frame_length(char *buffer, ssize_t nbytes);
 
 int startswith(char *prefix, char *str);
 